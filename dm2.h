@@ -15,168 +15,30 @@
  */
 
 
-/* Structure with complete parameter set for a DM2. */
-/* Use this to encode program sets and to set the */
-/* SysEx message. All values are thus 7 bit values! */
-
-struct dm2_params {
-	// Slider parameters:  X  Y  Fader
-	u8 sliderparam[3];
-
-	u8 sliderdeadzone;
-	u8 paramthresh;
-	u8 cursorthresh;
-
-	u8 wheel0jogparam;
-	u8 wheel1jogparam;
-	// Wheel button Notes/Params:  NW   W  SW   S  SE   E  NE   N
-	u8 wheel0notes[8];
-	u8 wheel0params[8];
-	u8 wheel1notes[8];
-	u8 wheel1params[8];
-	// Use parameters in relative mode: nn NW  W  SW  SE  E  NE  N
-	u8 relparams0, relparams1;
-	// Disable toggle mode on which keys: nn NW  W  SW  SE  E  NE  N
-	u8 notoggle0, notoggle1;
-	// First button set: Stop  Play  Rec  T3  T2  T1   R   L
-	u8 buttons0[8];
-	// Second button set: nn Mid  B  A  B4  B3  B2  B1
-	u8 buttons1[8];
-	// Mid button up/down keys, on-release keys
-	u8 midup0, middown0, midup1, middown1, midrel0, midrel1;
-	// Exclusive mode? (only one param at a time)
-	u8 excl0, excl1;
-
-	// Notes to activate LEDs: NW  W  SW  S  SE  E  NE  N
-	u8 led0notes[8];
-	u8 led1notes[8];
-	// Activate/deactivate idle loop
-	u8 led0idle, led1idle;
-};
+#include "dm2core.h"
 
-/* How to parameterize LED keys:
- *
- * allowed combination       meaning
- * notoggle note  param
- * off      set   unset      press: note on; release: note off.
- * off      unset set        press: wheel into param mode, lock. 2nd release: unlock
- * on       unset set        press: wheel into param mode. release: nothing
- * off      set   set        press: wheel into param mode, lock. 2nd release: note on if wheel turned, unlock
- * on       set   set        press: wheel into param mode. release: note on if no wheel turn.
- */
 
-#define DM2_NUMPRESETS 3
-static struct dm2_params dm2_params[DM2_NUMPRESETS] = {
-	{ // Program 0: Default program (for Mixxx)
-		.sliderparam = {4, 5, 2},
-		.sliderdeadzone = 5,
-		.paramthresh = 4,
-		.cursorthresh = 12,
-		.wheel0jogparam = 1,
-		.wheel1jogparam = 3,
-		//                NW   W  SW   S  SE   E  NE   N
-		.wheel0notes =  { 16, 17, 18,  0, 20, 21, 22,  0 },
-		.wheel0params = { 16, 17, 18,  0, 20, 21, 22, 23 },
-		.wheel1notes =  { 32, 33, 34,  0, 36, 37, 38,  0 },
-		.wheel1params = { 32, 33, 34,  0, 36, 37, 38, 39 },
-		// All params in absolute mode.
-		.relparams0 = 0,
-		.relparams1 = 0,
-		// Disable toggle mode on which keys: nn NW  W  SW  SE  E  NE  N
-		.notoggle0 = 0x3f,
-		.notoggle1 = 0x3f,
-		// First button set: Stop  Play  Rec  T3  T2  T1   R   L
-		.buttons0 =     { 48, 49, 50, 51, 52, 53, 54, 55 },
-		//                nn Mid   B   A  B4  B3  B2  B1
-		.buttons1 =     {  0,  0, 58, 59, 60, 61, 62, 63 },
-		// Mid button up/down keys, on-release keys
-		.midup0 = 65,
-		.midup1 = 65,
-		.middown0 = 66,
-		.middown1 = 66,
-		.midrel0 = 67,
-		.midrel1 = 68,
-		// Exclusive mode? (only one param at a time)
-		.excl0 = 1, .excl1 = 1,
-		// LED buttons activated by these notes:
-		.led0notes =  { 64, 65, 66, 67, 68, 69, 70, 71 },
-		.led1notes =  { 80, 81, 82, 83, 84, 85, 86, 87 },
-		.led0idle = 88, .led1idle = 89
-	},
-	{ // Program 1: Simple program (only CC multiplexing with toggle switches)
-		.sliderparam = {4, 5, 2},
-		.sliderdeadzone = 5,
-		.paramthresh = 4,
-		.cursorthresh = 12,
-		.wheel0jogparam = 1,
-		.wheel1jogparam = 3,
-		//            NW   W  SW   S  SE   E  NE   N
-		.wheel0notes =  {  0,  0,  0,  0,  0,  0,  0,  0 },
-		.wheel0params = { 16, 17, 18,  0, 20, 21, 22, 23 },
-		.wheel1notes =  {  0,  0,  0,  0,  0,  0,  0,  0 },
-		.wheel1params = { 32, 33, 34,  0, 36, 37, 38, 39 },
-		// All params in absolute mode.
-		.relparams0 = 0,
-		.relparams1 = 0,
-		// Disable toggle mode on which keys: nn NW  W  SW  SE  E  NE  N
-		.notoggle0 = 0x00,
-		.notoggle1 = 0x00,
-		// First button set: Stop  Play  Rec  T3  T2  T1   R   L
-		.buttons0 =     { 48, 49, 50, 51, 52, 53, 54, 55 },
-		//                     nn Mid   B   A  B4  B3  B2  B1
-		.buttons1 =     {  0,  0, 58, 59, 60, 61, 62, 63 },
-		// Mid button up/down keys, on-release keys
-		.midup0 = 65,
-		.midup1 = 65,
-		.middown0 = 66,
-		.middown1 = 66,
-		.midrel0 = 67,
-		.midrel1 = 68,
-		// Exclusive mode? (only one param at a time)
-		.excl0 = 0, .excl1 = 0,
-		// LED buttons activated by these notes:
-		.led0notes =  { 64, 65, 66, 67, 68, 69, 70, 71 },
-		.led1notes =  { 80, 81, 82, 83, 84, 85, 86, 87 },
-		.led0idle = 88, .led1idle = 89
-	},
-	{ // Program 2: Cinelerra, only relative controls
-		.sliderparam = {4, 5, 2},
-		.sliderdeadzone = 5,
-		.paramthresh = 6,
-		.cursorthresh = 20,
-		.wheel0jogparam = 1,
-		.wheel1jogparam = 3,
-		//            NW   W  SW   S  SE   E  NE   N
-		.wheel0notes =  { 16, 17, 18,  0, 20, 21, 22, 23 },
-		.wheel0params = { 16, 17, 18,  0, 20, 21, 22, 23 },
-		.wheel1notes =  { 32, 33, 34,  0, 36, 37, 38, 39 },
-		.wheel1params = { 32, 33, 34,  0, 36, 37, 38, 39 },
-		// All params in relative mode:
-		.relparams0 = 0x7f,
-		.relparams1 = 0x7f,
-		// Disable toggle mode on which keys: nn NW  W  SW  SE  E  NE  N
-		.notoggle0 = 0x7f,
-		.notoggle1 = 0x7f,
-		// First button set: Stop  Play  Rec  T3  T2  T1   R   L
-		.buttons0 =     { 48, 49, 50, 51, 52, 53, 54, 55 },
-		//                     nn Mid   B   A  B4  B3  B2  B1
-		.buttons1 =     {  0,  0, 58, 59, 60, 61, 62, 63 },
-		// Mid button up/down keys, on-release keys
-		.midup0 = 65,
-		.midup1 = 66,
-		.middown0 = 67,
-		.middown1 = 68,
-		.midrel0 = 69,
-		.midrel1 = 70,
-		// Exclusive mode? (only one param at a time)
-		.excl0 = 0, .excl1 = 0,
-		// LED buttons activated by these notes:
-		.led0notes =  { 64, 65, 66, 67, 68, 69, 70, 71 },
-		.led1notes =  { 80, 81, 82, 83, 84, 85, 86, 87 },
-		.led0idle = 88, .led1idle = 89
-	}
-};
+#define DM2_MIDIBUFSIZE 256	/* MIDI bytes collected per processing pass */
+#define DM2_UMPBUFSIZE 128	/* UMP words collected per processing pass */
+#define DM2_HOSTBUFSIZE 1024	/* MIDI bytes from the host per processing pass, power of 2 */
 
+/* SysEx from the host: F0 7D <command> <data> F7 (7D: non-commercial) */
+#define DM2_SYSEXID		0x7d
+#define DM2_SYSEX_PARAMS	0x01	/* data: struct dm2_params, becomes the mapping */
+#define DM2_SYSEX_DUMP		0x02	/* no data: send every control's value */
+
+/* MIDI from one host port, on its way to dm2_process() */
+#define DM2_HOST_RAWMIDI	0
+#define DM2_HOST_SEQ		1
+#define DM2_HOST_UMP		2
+#define DM2_NUMHOST		3
+
+struct dm2hostbuf {
+	u8			buf[DM2_HOSTBUFSIZE];
+	unsigned int		head, tail;
+	ktime_t			stamp;		/* When the newest bytes came */
+	struct dm2parser	parser;		/* Running status and SysEx of this port */
+};
 
 struct dm2midi {
 	struct snd_card			*card;
@@ -189,133 +51,171 @@ struct dm2midi {
 
 	u8		   	chan;		/* MIDI channel */
 	u8			out_rstatus;	/* MIDI Running status reminder */
-	u8			in_rstatus;	/* same for input */
-	u8			in_arg1;	/* 1st argument for input */
-};
 
-
-struct dm2slider {
-	u8			pos;		/* Current position */
-	u8			min, max, mid;	/* Values for auto-calibration */
-	u8			dead;		/* Dead zone width in slider units */
-	u8			param;
-	u8			midival;
+	struct dm2hostbuf	host[DM2_NUMHOST];	/* MIDI from the host for dm2_process() */
+	spinlock_t		hostlock;	/* Serializes the writers of host[] */
+	ktime_t			hoststamp;	/* When the bytes being parsed came */
+
+	u8			outbuf[DM2_MIDIBUFSIZE];	/* Pending bytes for the input substream */
+	int			outlen;
+
+	int			seqclient;	/* Sequencer kernel client, -1 if unused */
+	int			seqport;
+	ktime_t			stamp;		/* Time of the report or host bytes being processed */
+	ktime_t			firststamp;	/* Completion time of the oldest unflushed event */
+	int			stamped;	/* firststamp is valid */
+	int			hostout;	/* Output caused by the host, stamp is its time */
+
+	struct snd_ump_endpoint	*ump;		/* MIDI 2.0 endpoint, NULL if unused */
+	u32			umpbuf[DM2_UMPBUFSIZE];	/* Pending words for the UMP input */
+	int			umplen;
+	u32			umpin[4];	/* Packet being received from the host */
+	int			umpinlen;
 };
 
 
-#define DM2_MIDINDEX 3
-#define DM2_MIDMASK 0x02
-#define DM2_CLR 0x08
-#define DM2_MID(v) (((v)&DM2_MIDMASK)<<2)
 
+/* Vendor and Product ID of the Mixman DM2 */
+#define USB_DM2_VENDOR_ID	0x0665
+#define USB_DM2_PRODUCT_ID	0x0301
 
-struct dm2wheel {
-	u8			pressed;	/* Map of pressed keys */
-	u8			light;		/* Which are locked now */
-	u8			whenreleased;	/* Which state to assume when released */
-	u8			notes[8];	/* Note to be used for each button. 0 disables. */
-	u8			params[8];	/* Param for controller. 0 disables. */
-	u8			midivals[8];
-	u8			relparams;	/* Params which send relative values. */
-	u8			notoggle;      	/* Buttons which do not toggle. */
-	u8			exclusive;	/* Only one param active at a time */
+/* table of devices that work with this driver */
+static struct usb_device_id dm2_table [] = {
+	{ USB_DEVICE(USB_DM2_VENDOR_ID, USB_DM2_PRODUCT_ID) },
+	{ }					/* Terminating entry */
+};
+MODULE_DEVICE_TABLE(usb, dm2_table);
 
-	u8			paramthresh;	/* Wheel turn threshold for adjusting parameters */
-	u8			cursorthresh;	/* Wheel turn threshold for adjusting the cursor */
 
-	u8			jogparam;
-	u8			jogmidival;
-	u8			midpressed;
+#define DM2_LEDLEN		4	/* Size of an LED output transfer */
+#define DM2_LEDCLOCK_RUNNING	0	/* ledflags: animation clock is armed */
+#define DM2_LEDCLOCK_STOPPED	1	/* ledflags: device is going away */
+#define DM2_MAXINURBS		8	/* Upper limit for input URBs in flight */
 
-	u8			midup;		/* If set: "up" key while mid is pressed */
-	u8			middown;	/* If set: "down" key while mid id pressed */
-	u8			midrel;		/* If set: key pressed when mid is released */
-	u8			wheelused;	/* Set if wheel has turned while holding a key */
 
-	int			showlight;	/* Make sure lights are shown */
-	int			turnacc;	/* Turn accumulator before increment is done. */
-};
+/* Ring of received reports, filled by the URB completion and drained */
+/* by dm2_process(). Single producer, single consumer, so no lock needed. */
 
+#define DM2_RINGSIZE 64		/* Must be a power of two */
 
-struct dm2buttons {
-	u8			pressed;
-	u8			notes[8];
+struct dm2report {
+	ktime_t			time;		/* Time of URB completion */
+	u8			data[DM2_REPORTLEN];
 };
 
-#define DM2_LEDIDLEINT 20
-#define DM2_LEDTIMEOUT 100
-
-struct dm2leds {
-	int			timeout;		/* remaining duration of overlay */
-	int			wheeltimeout;		/* Wheel should show through */
-	int			idletimeout;		/* Delay between idle loop advances */
-	u8			curr;			/* current setting */
-	u8			wheel;			/* Setting from the wheel buttons */
-	u8			mask;			/* LEDs masked by foreign input */
-	u8			light;			/* Light setting not from wheels */
-	u8			idlelight;		/* State of the idle loop */
-	u8			notes[8];		/* Note on/off that we interpret */
-	u8			idlenote;		/* Note that switches the idle loop */
+struct dm2ring {
+	unsigned int		head;		/* Only written by the producer */
+	unsigned int		tail;		/* Only written by the consumer */
+	struct dm2report	reports[DM2_RINGSIZE];
 };
 
 
-struct dm2 {
-	u8			prev_state[10];
-	u8			curr_state[10];
-	struct dm2slider	sliders[3];
-	int			initialize;	/* Signals that the pots have to be initalized */
-
-	struct dm2wheel		wheels[2];
-	struct dm2buttons	buttons[2];
-	struct dm2leds		leds[2];
+/* Counters for diagnosing the driver, shown in debugfs */
+
+#define DM2_NUMERRS		128	/* URB status codes counted one by one */
+#define DM2_LATBUCKETS		24	/* log2 latency histogram, 1 us to 8 s */
+
+struct dm2stats {
+	unsigned long		reports;	/* Input URBs completed with data */
+	unsigned long		badlength;	/* Reports of unexpected length */
+	unsigned long		in_errors[DM2_NUMERRS];	 /* Input URB errors by -status, others in [0] */
+	unsigned long		out_errors[DM2_NUMERRS]; /* Output URB errors by -status, others in [0] */
+	unsigned long		overruns;	/* Reports lost because the ring was full */
+	unsigned long		late;		/* Completions later than the endpoint interval */
+	unsigned long		missed;		/* Polling intervals skipped by late completions */
+	unsigned long		leds_merged;	/* LED updates replaced before being sent */
+	unsigned long		leds_written;	/* LED output URBs submitted */
+	unsigned long		leds_failed;	/* LED states lost because submitting failed */
+	unsigned long		passes;		/* Runs of dm2_process() */
+	unsigned long		midibytes;	/* MIDI bytes handed to the rawmidi input */
+	unsigned long		umpbytes;	/* Bytes handed to the UMP input */
+	unsigned long		rstatus_hits;	/* Status bytes saved by running status */
+	unsigned long		hostbytes;	/* MIDI bytes parsed from the host */
+	unsigned long		hostdrains;	/* Pieces they were taken from the output substream in */
+	unsigned long		hostdropped;	/* Sequencer/UMP bytes lost: hostbuf full, SysEx too long */
+	unsigned long		sysex;		/* SysEx messages taken */
+	unsigned long		sysex_bad;	/* ... with unknown commands */
+	unsigned long		preset_switches; /* Program changes applied */
+	unsigned long		preset_late;	/* Reports handled with a program change pending */
+	u64			preset_lat_last; /* Program change to switch time in ns */
+	u64			preset_lat_max;
+	unsigned long		lat_count;	/* Passes that produced MIDI */
+	u64			lat_sum;	/* Total completion-to-MIDI latency in ns */
+	u64			lat_max;	/* Worst completion-to-MIDI latency in ns */
+	unsigned long		lat_hist[DM2_LATBUCKETS]; /* [n]: latency below 2^n us */
 };
 
 
+/* Where dm2_process() runs */
 
-/* Vendor and Product ID of the Mixman DM2 */
-#define USB_DM2_VENDOR_ID	0x0665
-#define USB_DM2_PRODUCT_ID	0x0301
-
-/* table of devices that work with this driver */
-static struct usb_device_id dm2_table [] = {
-	{ USB_DEVICE(USB_DM2_VENDOR_ID, USB_DM2_PRODUCT_ID) },
-	{ }					/* Terminating entry */
-};
-MODULE_DEVICE_TABLE(usb, dm2_table);
+#define DM2_CTX_TASKLET		0
+#define DM2_CTX_INLINE		1	/* directly in the URB completion */
+#define DM2_CTX_WORK		2	/* high priority (BH) workqueue */
+#define DM2_CTX_THREAD		3	/* own kthread with RT priority */
+#define DM2_NUMCTX		4
 
+#define DM2_PROC_AGAIN		0	/* procflags: run another pass */
+#define DM2_PROC_WAKE		1	/* procflags: wake the thread */
+#define DM2_PROC_STOPPED	2	/* procflags: device is going away */
+#define DM2_PROC_HOSTFULL	3	/* procflags: hostbuf was full, drain again */
 
-#define MAX_TRANSFER		(PAGE_SIZE - 512)
-/* MAX_TRANSFER is chosen so that the VM is not stressed by
-   allocations > PAGE_SIZE and the number of packets in a page
-   is an integer 512 is the largest possible packet on EHCI */
-#define WRITES_IN_FLIGHT	8
+#define DM2_SYSEXPRESET		DM2_MAXPRESETS	/* preset: mapping from SysEx */
 
 
 /* Structure to hold all of our device specific stuff */
 struct usb_dm2 {
 	struct usb_device	*udev;			/* the usb device for this device */
 	struct usb_interface	*interface;		/* the interface for this device */
-	struct semaphore	limit_sem;		/* limiting the number of writes in progress */
 	unsigned char           *int_in_buffer;		/* the buffer to receive data */
 	size_t			int_in_size;		/* the size of the receive buffer */
 	__u8			int_in_endpointAddr;	/* the address of the int in endpoint */
 	__u8			int_out_endpointAddr;	/* the address of the int/bulk out endpoint */
 	int			output_failed;		/* flag which indicates an unpatched kernel */
 	struct kref		kref;
-	struct urb		*int_in_urb;
+	struct urb		*int_in_urbs[DM2_MAXINURBS];	/* input URB pool */
+	int			int_in_count;		/* number of URBs in the pool */
 	int			int_in_interval;
-
-	struct urb		*int_out_urb;		/* output URB */
-	unsigned char           *int_out_buffer;	/* the buffer to send data */
+	s64			int_in_last;		/* last completion time in us, 0 if none */
+
+	struct urb		*int_out_urbs[2];	/* double-buffered output URBs */
+	int			int_out_next;		/* back buffer, holds the latest LED state */
+	int			int_out_busy;		/* the front buffer is in flight */
+	int			int_out_pending;	/* back buffer has not been sent yet */
+
+	struct hrtimer		ledclock;		/* LED animation clock */
+	ktime_t			ledperiod;		/* duration of one LED frame */
+	unsigned long		ledflags;		/* DM2_LEDCLOCK_* bits */
+	atomic_t		ledticks;		/* frames not yet seen by dm2_process() */
+	int			ledactive;		/* something is animating */
+
+	int			context;		/* DM2_CTX_* */
+	spinlock_t		proclock;		/* serializes dm2_process() */
+	unsigned long		procflags;		/* DM2_PROC_* bits */
+	struct work_struct	work;
+	struct task_struct	*thread;
+	wait_queue_head_t	procwait;
 
 	struct dm2		dm2;
+	const struct dm2_params	*presets;		/* dm2_params, or loaded from a file */
+	int			npresets;
+	char			presetfile[64];		/* File the presets came from */
+	struct dm2_params	sysexparams;		/* Mapping from SysEx */
+	int			preset;			/* Preset in use, or DM2_SYSEXPRESET */
+	atomic_t		presetreq;		/* Preset to switch to, plus one; 0 if none */
+	ktime_t			presetstamp;		/* Time of the program change */
+	struct dm2_calibration	calib[3];		/* Slider ranges to restore */
+	int			calibrated;		/* calib is valid */
 	struct dm2midi          dm2midi;
-	spinlock_t		lock;			/* To protect tasklet from irq handler */
+	struct dm2ring		ring;			/* Reports waiting for dm2_process() */
+	struct dm2stats		stats;
+	struct dentry		*debugfs;		/* our debugfs directory */
+	spinlock_t		lock;			/* To protect processing from irq handler, guards int_out_* */
 };
 #define to_dm2_dev(d) container_of(d, struct usb_dm2, kref)
 
 
-static void dm2_midi_send(struct usb_dm2 *, u8, u8, u8);
-static void dm2_set_leds(struct usb_dm2 *, u8, u8);
+static void dm2_midi_flush(struct usb_dm2 *);
+static void dm2_host_parse(struct usb_dm2 *);
+static void dm2_calibration_apply(struct usb_dm2 *);
 
 static void dm2_delete(struct kref *);
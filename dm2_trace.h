@@ -0,0 +1,163 @@
+/*
+ * dm2_trace.h  -  Tracepoints of the Mixman DM2 driver
+ *
+ *
+ * Copyright (C) 2007-2008 Jan Jockusch (jan@jockusch.de)
+ *
+ *	This program is free software; you can redistribute it and/or
+ *	modify it under the terms of the GNU General Public License as
+ *	published by the Free Software Foundation, version 2.
+ *
+ */
+
+/* Follow a report through the driver with ftrace or perf:
+ *
+ *   dm2_report         raw bytes as they arrive in the URB completion
+ *   dm2_wheel_update   key bitmask transitions of a wheel
+ *   dm2_wheel_turn     wheel step and turn accumulator
+ *   dm2_slider_update  raw and calibrated slider value
+ *   dm2_midi_send      every MIDI message, with running status
+ *   dm2_write          LED bytes going out to the device
+ */
+
+#undef TRACE_SYSTEM
+#define TRACE_SYSTEM dm2
+
+#if !defined(_DM2_TRACE_H) || defined(TRACE_HEADER_MULTI_READ)
+#define _DM2_TRACE_H
+
+#include <linux/tracepoint.h>
+
+TRACE_EVENT(dm2_report,
+	TP_PROTO(const u8 *data, int length, int status),
+	TP_ARGS(data, length, status),
+	TP_STRUCT__entry(
+		__field(int, length)
+		__field(int, status)
+		__array(u8, data, 10)
+	),
+	TP_fast_assign(
+		__entry->length = length;
+		__entry->status = status;
+		memset(__entry->data, 0, 10);
+		if (!status) memcpy(__entry->data, data, min(length, 10));
+	),
+	TP_printk("status=%d len=%d data=%s", __entry->status, __entry->length,
+		  __print_hex(__entry->data, 10))
+);
+
+TRACE_EVENT(dm2_wheel_update,
+	TP_PROTO(int wheel, u8 pressed, u8 curr, u8 midpressed, u8 currmid,
+		 u8 light, u8 whenreleased),
+	TP_ARGS(wheel, pressed, curr, midpressed, currmid, light, whenreleased),
+	TP_STRUCT__entry(
+		__field(int, wheel)
+		__field(u8, pressed)
+		__field(u8, curr)
+		__field(u8, midpressed)
+		__field(u8, currmid)
+		__field(u8, light)
+		__field(u8, whenreleased)
+	),
+	TP_fast_assign(
+		__entry->wheel = wheel;
+		__entry->pressed = pressed;
+		__entry->curr = curr;
+		__entry->midpressed = midpressed;
+		__entry->currmid = currmid;
+		__entry->light = light;
+		__entry->whenreleased = whenreleased;
+	),
+	TP_printk("wheel=%d keys=%02x->%02x mid=%x->%x light=%02x whenreleased=%02x",
+		  __entry->wheel, __entry->pressed, __entry->curr,
+		  __entry->midpressed, __entry->currmid,
+		  __entry->light, __entry->whenreleased)
+);
+
+TRACE_EVENT(dm2_wheel_turn,
+	TP_PROTO(int wheel, int diff, int turnacc, int midiadd, u8 pressed, u8 light),
+	TP_ARGS(wheel, diff, turnacc, midiadd, pressed, light),
+	TP_STRUCT__entry(
+		__field(int, wheel)
+		__field(int, diff)
+		__field(int, turnacc)
+		__field(int, midiadd)
+		__field(u8, pressed)
+		__field(u8, light)
+	),
+	TP_fast_assign(
+		__entry->wheel = wheel;
+		__entry->diff = diff;
+		__entry->turnacc = turnacc;
+		__entry->midiadd = midiadd;
+		__entry->pressed = pressed;
+		__entry->light = light;
+	),
+	TP_printk("wheel=%d diff=%d acc=%d add=%d keys=%02x light=%02x",
+		  __entry->wheel, __entry->diff, __entry->turnacc,
+		  __entry->midiadd, __entry->pressed, __entry->light)
+);
+
+TRACE_EVENT(dm2_slider_update,
+	TP_PROTO(int slider, u8 raw, int value, u8 min, u8 mid, u8 max),
+	TP_ARGS(slider, raw, value, min, mid, max),
+	TP_STRUCT__entry(
+		__field(int, slider)
+		__field(int, value)
+		__field(u8, raw)
+		__field(u8, min)
+		__field(u8, mid)
+		__field(u8, max)
+	),
+	TP_fast_assign(
+		__entry->slider = slider;
+		__entry->value = value;
+		__entry->raw = raw;
+		__entry->min = min;
+		__entry->mid = mid;
+		__entry->max = max;
+	),
+	TP_printk("slider=%d raw=%u value=%d min=%u mid=%u max=%u",
+		  __entry->slider, __entry->raw, __entry->value,
+		  __entry->min, __entry->mid, __entry->max)
+);
+
+TRACE_EVENT(dm2_midi_send,
+	TP_PROTO(u8 status, u8 param, u8 value, int running),
+	TP_ARGS(status, param, value, running),
+	TP_STRUCT__entry(
+		__field(u8, status)
+		__field(u8, param)
+		__field(u8, value)
+		__field(int, running)
+	),
+	TP_fast_assign(
+		__entry->status = status;
+		__entry->param = param;
+		__entry->value = value;
+		__entry->running = running;
+	),
+	TP_printk("%02x %02x %02x%s", __entry->status, __entry->param,
+		  __entry->value, __entry->running ? " (running status)" : "")
+);
+
+TRACE_EVENT(dm2_write,
+	TP_PROTO(const u8 *data),
+	TP_ARGS(data),
+	TP_STRUCT__entry(
+		__array(u8, data, 4)
+	),
+	TP_fast_assign(
+		memcpy(__entry->data, data, 4);
+	),
+	TP_printk("leds=%s", __print_hex(__entry->data, 4))
+);
+
+#endif /* _DM2_TRACE_H */
+
+/* This part must be outside protection */
+#undef TRACE_INCLUDE_PATH
+#define TRACE_INCLUDE_PATH .
+#undef TRACE_INCLUDE_FILE
+#define TRACE_INCLUDE_FILE dm2_trace
+#include <trace/define_trace.h>
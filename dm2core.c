@@ -0,0 +1,1217 @@
+/*
+ * dm2core.c  -  Mixman DM2 state machines: reports to MIDI, MIDI to LEDs
+ *
+ *
+ * Copyright (C) 2007-2008 Jan Jockusch (jan@jockusch.de)
+ * Copyright (C) 2006-2008 Andre Roth <lynx@netlabs.org>
+ *
+ *	This program is free software; you can redistribute it and/or
+ *	modify it under the terms of the GNU General Public License as
+ *	published by the Free Software Foundation, version 2.
+ *
+ */
+
+#ifdef __KERNEL__
+#include <linux/kernel.h>
+#include <linux/string.h>
+#else
+#include <string.h>
+#endif
+
+#include "dm2core.h"
+
+/* Index of the lowest set bit, for walking key masks */
+#ifdef __KERNEL__
+#define dm2_ctz(x)	__ffs(x)
+#else
+#define dm2_ctz(x)	__builtin_ctz(x)
+#endif
+
+#ifdef __KERNEL__
+#include "dm2_trace.h"
+#else
+static inline void trace_dm2_wheel_update(int wheel, u8 pressed, u8 curr, u8 midpressed,
+					  u8 currmid, u8 light, u8 whenreleased) { }
+static inline void trace_dm2_wheel_turn(int wheel, int diff, int turnacc, int midiadd,
+					u8 pressed, u8 light) { }
+static inline void trace_dm2_slider_update(int slider, u8 raw, int value,
+					   u8 min, u8 mid, u8 max) { }
+#endif
+
+
+struct dm2_params dm2_params[DM2_NUMPRESETS] = {
+	{ // Program 0: Default program (for Mixxx)
+		.sliderparam = {4, 5, 2},
+		.sliderdeadzone = 5,
+		.sliderhyst = {1, 1, 1},
+		.paramthresh = 4,
+		.cursorthresh = 12,
+		.wheel0jogparam = 1,
+		.wheel1jogparam = 3,
+		//                NW   W  SW   S  SE   E  NE   N
+		.wheel0notes =  { 16, 17, 18,  0, 20, 21, 22,  0 },
+		.wheel0params = { 16, 17, 18,  0, 20, 21, 22, 23 },
+		.wheel1notes =  { 32, 33, 34,  0, 36, 37, 38,  0 },
+		.wheel1params = { 32, 33, 34,  0, 36, 37, 38, 39 },
+		// All params in absolute mode.
+		.relparams0 = 0,
+		.relparams1 = 0,
+		// Disable toggle mode on which keys: nn NW  W  SW  SE  E  NE  N
+		.notoggle0 = 0x3f,
+		.notoggle1 = 0x3f,
+		// First button set: Stop  Play  Rec  T3  T2  T1   R   L
+		.buttons0 =     { 48, 49, 50, 51, 52, 53, 54, 55 },
+		//                nn Mid   B   A  B4  B3  B2  B1
+		.buttons1 =     {  0,  0, 58, 59, 60, 61, 62, 63 },
+		// Mid button up/down keys, on-release keys
+		.midup0 = 65,
+		.midup1 = 65,
+		.middown0 = 66,
+		.middown1 = 66,
+		.midrel0 = 67,
+		.midrel1 = 68,
+		// Exclusive mode? (only one param at a time)
+		.excl0 = 1, .excl1 = 1,
+		// LED buttons activated by these notes:
+		.led0notes =  { 64, 65, 66, 67, 68, 69, 70, 71 },
+		.led1notes =  { 80, 81, 82, 83, 84, 85, 86, 87 },
+		.led0idle = 88, .led1idle = 89
+	},
+	{ // Program 1: Simple program (only CC multiplexing with toggle switches)
+		.sliderparam = {4, 5, 2},
+		.sliderdeadzone = 5,
+		.sliderhyst = {1, 1, 1},
+		.paramthresh = 4,
+		.cursorthresh = 12,
+		.wheel0jogparam = 1,
+		.wheel1jogparam = 3,
+		//            NW   W  SW   S  SE   E  NE   N
+		.wheel0notes =  {  0,  0,  0,  0,  0,  0,  0,  0 },
+		.wheel0params = { 16, 17, 18,  0, 20, 21, 22, 23 },
+		.wheel1notes =  {  0,  0,  0,  0,  0,  0,  0,  0 },
+		.wheel1params = { 32, 33, 34,  0, 36, 37, 38, 39 },
+		// All params in absolute mode.
+		.relparams0 = 0,
+		.relparams1 = 0,
+		// Disable toggle mode on which keys: nn NW  W  SW  SE  E  NE  N
+		.notoggle0 = 0x00,
+		.notoggle1 = 0x00,
+		// First button set: Stop  Play  Rec  T3  T2  T1   R   L
+		.buttons0 =     { 48, 49, 50, 51, 52, 53, 54, 55 },
+		//                     nn Mid   B   A  B4  B3  B2  B1
+		.buttons1 =     {  0,  0, 58, 59, 60, 61, 62, 63 },
+		// Mid button up/down keys, on-release keys
+		.midup0 = 65,
+		.midup1 = 65,
+		.middown0 = 66,
+		.middown1 = 66,
+		.midrel0 = 67,
+		.midrel1 = 68,
+		// Exclusive mode? (only one param at a time)
+		.excl0 = 0, .excl1 = 0,
+		// LED buttons activated by these notes:
+		.led0notes =  { 64, 65, 66, 67, 68, 69, 70, 71 },
+		.led1notes =  { 80, 81, 82, 83, 84, 85, 86, 87 },
+		.led0idle = 88, .led1idle = 89
+	},
+	{ // Program 2: Cinelerra, only relative controls
+		.sliderparam = {4, 5, 2},
+		.sliderdeadzone = 5,
+		.sliderhyst = {1, 1, 1},
+		.paramthresh = 6,
+		.cursorthresh = 20,
+		.wheel0jogparam = 1,
+		.wheel1jogparam = 3,
+		//            NW   W  SW   S  SE   E  NE   N
+		.wheel0notes =  { 16, 17, 18,  0, 20, 21, 22, 23 },
+		.wheel0params = { 16, 17, 18,  0, 20, 21, 22, 23 },
+		.wheel1notes =  { 32, 33, 34,  0, 36, 37, 38, 39 },
+		.wheel1params = { 32, 33, 34,  0, 36, 37, 38, 39 },
+		// All params in relative mode:
+		.relparams0 = 0x7f,
+		.relparams1 = 0x7f,
+		// Disable toggle mode on which keys: nn NW  W  SW  SE  E  NE  N
+		.notoggle0 = 0x7f,
+		.notoggle1 = 0x7f,
+		// First button set: Stop  Play  Rec  T3  T2  T1   R   L
+		.buttons0 =     { 48, 49, 50, 51, 52, 53, 54, 55 },
+		//                     nn Mid   B   A  B4  B3  B2  B1
+		.buttons1 =     {  0,  0, 58, 59, 60, 61, 62, 63 },
+		// Mid button up/down keys, on-release keys
+		.midup0 = 65,
+		.midup1 = 66,
+		.middown0 = 67,
+		.middown1 = 68,
+		.midrel0 = 69,
+		.midrel1 = 70,
+		// Exclusive mode? (only one param at a time)
+		.excl0 = 0, .excl1 = 0,
+		// LED buttons activated by these notes:
+		.led0notes =  { 64, 65, 66, 67, 68, 69, 70, 71 },
+		.led1notes =  { 80, 81, 82, 83, 84, 85, 86, 87 },
+		.led0idle = 88, .led1idle = 89
+	}
+};
+
+
+/* Send a 14 bit value as CC param (MSB) and param+32 (LSB). A new MSB */
+/* clears the LSB on the receiving side, so only nonzero LSBs follow it. */
+static void dm2_send14(struct dm2 *dm2, u8 param, u8 *msb, u8 *lsb, int value)
+{
+	u8 newmsb = value >> 7, newlsb = value & 0x7f;
+
+	if (newmsb != *msb) {
+		dm2_midi_send(dm2, 0xb0, param, newmsb);
+		*msb = newmsb;
+		*lsb = 0;
+	}
+	if (newlsb != *lsb) {
+		dm2_midi_send(dm2, 0xb0, param + 32, newlsb);
+		*lsb = newlsb;
+	}
+}
+
+/* MIDI 2.0 min-center-max upscaling of a value with the given width */
+/* to 32 bits. Zero, the center and the top of the range stay exact. */
+static u32 dm2_ump_scale(u32 value, int bits)
+{
+	int shift = 32 - bits, rbits = bits - 1;
+	u32 result = value << shift, repeat;
+
+	if (value <= (1u << rbits)) return result;
+	repeat = value & ((1u << rbits) - 1);
+	repeat = (shift > rbits) ? repeat << (shift - rbits) : repeat >> (rbits - shift);
+	while (repeat) {
+		result |= repeat;
+		repeat >>= rbits;
+	}
+	return result;
+}
+
+/* Note on or off, on the UMP side as MIDI 2.0 note with 16 bit velocity */
+static void dm2_note(struct dm2 *dm2, u8 note, u8 vel)
+{
+	dm2_midi_send(dm2, 0x90, note, vel);
+	if (!dm2->ump) return;
+	if (vel)
+		dm2_ump_send(dm2, DM2_UMP_NOTEON, note, dm2_ump_scale(vel, 7) >> 16);
+	else
+		dm2_ump_send(dm2, DM2_UMP_NOTEOFF, note, 0);
+}
+
+/* 7 bit CC, upscaled on the UMP side */
+static void dm2_cc(struct dm2 *dm2, u8 param, u8 value)
+{
+	dm2_midi_send(dm2, 0xb0, param, value);
+	if (dm2->ump) dm2_ump_send(dm2, DM2_UMP_CC, param, dm2_ump_scale(value, 7));
+}
+
+/* Calibrated value of a raw position with the given resolution, */
+/* center at half range */
+static int dm2_slider_value(struct dm2slider *slider, u8 pos, int bits)
+{
+	int value, half = 1 << (bits-1), top = (1 << bits) - 1;
+	u8 max = slider->max;
+
+	if (!max) max = (slider->mid<<1) - slider->min;
+	if (pos < slider->mid) {
+		value = ((pos - slider->min)*half /
+			 (slider->mid - slider->dead - slider->min));
+		if (value > half) value = half;
+	} else {
+		value = (top - (max - pos)*(top - half) /
+			 (max - slider->dead - slider->mid));
+		if (value < half) value = half;
+	}
+	if (value < 0) value = 0;
+	if (value > top) value = top;
+	return value;
+}
+
+/* Rebuild the table, whenever the calibration changes */
+static void dm2_slider_calibrate(struct dm2slider *slider)
+{
+	int raw, bits = slider->hires ? 14 : 7;
+
+	for (raw=0; raw<256; raw++)
+		slider->lut[raw] = dm2_slider_value(slider, raw, bits);
+}
+
+static void dm2_slider_reset(struct dm2slider *slider, u8 value)
+{
+	slider->pos = value;
+	slider->mid = value;
+	slider->min = value - slider->dead - 1;
+	slider->max = (slider->max) ? value + slider->dead + 1 : 0;
+	slider->midival = 64;
+	slider->midilsb = 0;
+	slider->umpval = 1 << 15;
+	slider->filt = value << 8;
+	slider->dir = 0;
+	slider->settling = slider->pending = 0;
+	dm2_slider_calibrate(slider);
+}
+
+/* Mapping of a slider, apart from its calibration */
+static void dm2_slider_map(struct dm2slider *slider, u8 param, u8 dead, u8 hires,
+			   u8 hyst, u8 filter, u8 interval)
+{
+	slider->param = param;
+	// Params from 32 on stay 7 bit, dm2_params_check() refuses them
+	slider->hires = hires && (param < 32);
+	slider->hyst = hyst;
+	slider->filter = (filter > 7) ? 7 : filter;
+	if (!slider->filter) slider->settling = 0;
+	slider->interval = interval * 1000;
+	slider->dead = dead;
+}
+
+static void dm2_slider_init(struct dm2slider *slider, u8 usemax)
+{
+	slider->last = 0;
+	slider->max = usemax;
+	dm2_slider_reset(slider, slider->mid ? slider->mid : 80);	/* Dummy value */
+}
+
+static void dm2_slider_set(struct dm2slider *slider, u8 value)
+{
+	int widened = 0;
+
+	if (value < slider->min) {
+		slider->min = value;
+		widened = 1;
+	}
+	if (slider->max && (value > slider->max)) {
+		slider->max = value;
+		widened = 1;
+	}
+	slider->pos = value;
+	if (widened) dm2_slider_calibrate(slider);
+}
+
+/* Smoothing, then hysteresis against noise on a boundary: a move */
+/* against the direction of the last one has to exceed hyst. */
+/* Returns the position to use, or -1 for no change. */
+static int dm2_slider_filter(struct dm2 *dm2, struct dm2slider *slider, u8 curr)
+{
+	int pos = curr, delta, dir;
+
+	if (slider->filter) {
+		slider->filt += ((curr << 8) - slider->filt) >> slider->filter;
+		pos = (slider->filt + 128) >> 8;
+		slider->settling = (pos != curr);
+		if (!slider->settling) slider->filt = curr << 8;
+	}
+	delta = pos - slider->pos;
+	if (!delta) return -1;
+	dir = (delta > 0) ? 1 : -1;
+	if ((dir != slider->dir) && (delta*dir <= slider->hyst)) {
+		dm2->counters.suppressed++;
+		return -1;
+	}
+	slider->dir = dir;
+	return pos;
+}
+
+/* raw is the report byte that led to this move */
+static void dm2_slider_emit(struct dm2 *dm2, struct dm2slider *slider, u8 raw)
+{
+	int value, full;
+
+	slider->pending = 0;
+	slider->last = dm2->now;
+	value = slider->lut[slider->pos];
+	trace_dm2_slider_update(slider - dm2->sliders, raw, value,
+				slider->min, slider->mid, slider->max);
+	if (dm2->ump) {
+		// 16 bit is well beyond the 8 bit sensor, no need for more
+		full = dm2_slider_value(slider, slider->pos, 16);
+		if (full != slider->umpval)
+			dm2_ump_send(dm2, DM2_UMP_CC, slider->param, dm2_ump_scale(full, 16));
+		slider->umpval = full;
+	}
+	if (slider->hires) {
+		dm2_send14(dm2, slider->param, &slider->midival, &slider->midilsb, value);
+		return;
+	}
+	if (value == slider->midival) return;
+	dm2_midi_send(dm2, 0xb0, slider->param, value);
+	slider->midival = value;
+	return;
+}
+
+static void dm2_slider_update(struct dm2 *dm2, struct dm2slider *slider, u8 curr)
+{
+	int pos = dm2_slider_filter(dm2, slider, curr);
+
+	if (pos < 0) return;
+	dm2_slider_set(slider, pos);
+	// Within the interval, only the last move is sent, by dm2_tick().
+	// The clock wraps, so compare unsigned; the first move is always due.
+	if (slider->interval && slider->last &&
+	    ((u32)(dm2->now - slider->last) < slider->interval)) {
+		if (slider->pending) dm2->counters.merged++;
+		slider->pending = 1;
+		return;
+	}
+	dm2_slider_emit(dm2, slider, curr);
+}
+
+static void dm2_wheel_map(struct dm2wheel *wheel, const u8 notes[8], const u8 params[8],
+			  u8 jogparam, u8 midup, u8 middown, u8 midrel, u8 exclusive,
+			  u8 relparams, u8 notoggle, u8 paramthresh, u8 cursorthresh,
+			  u8 hires, u8 posparam)
+{
+	int i;
+	u8 mask;
+
+	wheel->jogparam = jogparam;
+	wheel->posparam = (posparam < 32) ? posparam : 0;
+	wheel->noteonly = wheel->noteparam = wheel->parammask = 0;
+	for (i=0, mask=1; i<8; i++, mask<<=1) {
+		wheel->notes[i] = notes[i];
+		wheel->params[i] = params[i];
+		if (params[i]) wheel->parammask |= mask;
+		if (notes[i] && params[i]) wheel->noteparam |= mask;
+		else if (notes[i]) wheel->noteonly |= mask;
+	}
+	wheel->relparams = ((relparams<<1)&0xf0) | (relparams&0x07);
+	wheel->notoggle = ((notoggle<<1)&0xf0) | (notoggle&0x07);
+	wheel->midup = midup;
+	wheel->middown = middown;
+	wheel->midrel = midrel;
+	wheel->exclusive = exclusive;
+	wheel->paramthresh = paramthresh;
+	wheel->cursorthresh = cursorthresh;
+	wheel->hires = hires;
+}
+
+static void dm2_wheel_init(struct dm2wheel *wheel)
+{
+	int i;
+
+	wheel->turnacc = wheel->hiacc = wheel->showlight = 0;
+	wheel->pressed = wheel->light = wheel->whenreleased = 0;
+	wheel->noteson = 0;
+	wheel->midpressed = 0;
+	wheel->jogmidival = 64;
+	wheel->posmsb = wheel->poslsb = 0;
+	wheel->pos = 0;
+	for (i=0; i<8; i++) {
+		wheel->midivals[i] = 64;
+		wheel->midilsbs[i] = 0;
+	}
+	wheel->wheelused = 0;
+}
+
+/* Expand the preset's jog curve into steps for 0..128 ticks */
+static void dm2_jogtab_init(struct dm2 *dm2, const u8 curve[8])
+{
+	int i, k, lo, hi;
+
+	dm2->jogcurve = 0;
+	for (k=0; k<8; k++)
+		if (curve[k]) dm2->jogcurve = 1;
+	dm2->jogtab[0] = 0;
+	for (i=1; i<=128; i++) {
+		for (k=0; (2 << k) <= i; k++);
+		lo = curve[k];
+		hi = (k < 7) ? curve[k+1] : curve[7];
+		dm2->jogtab[i] = lo + (hi - lo) * (i - (1 << k)) / (1 << k);
+	}
+}
+
+static int dm2_jog_accel(struct dm2 *dm2, int diff)
+{
+	if (!dm2->jogcurve) return diff;
+	return (diff < 0) ? -dm2->jogtab[-diff] : dm2->jogtab[diff];
+}
+
+static void dm2_wheel_update(struct dm2 *dm2, struct dm2wheel *wheel, u8 curr, u8 currmid)
+{
+	u8 presses, releases, newlight, reset, mask, flagson, flagsoff;
+	u8 prevpressed, prevmid;
+	unsigned int bits;
+	int i;
+
+	currmid &= DM2_MIDMASK;
+	if ((wheel->pressed == curr) && (wheel->midpressed == currmid))
+		return;
+	prevpressed = wheel->pressed;
+	prevmid = wheel->midpressed;
+	wheel->turnacc = wheel->hiacc = 0;
+
+	// Calculate note on/off
+	presses = ~wheel->pressed & curr;
+	releases = wheel->pressed & ~curr;
+
+	flagson  = presses  & (wheel->notoggle | ~wheel->light);
+	flagsoff = releases & (wheel->notoggle | ~wheel->whenreleased);
+	bits = (flagson | flagsoff) & wheel->noteonly;
+	if (wheel->wheelused)
+		bits |= releases & ~wheel->notoggle & ~wheel->whenreleased & wheel->noteparam;
+	else
+		bits |= releases & wheel->notoggle & wheel->noteparam;
+	for (; bits; bits &= bits - 1) {
+		i = dm2_ctz(bits);
+		mask = 1 << i;
+		if ((mask & wheel->noteparam) || (mask & flagson))
+			dm2_note(dm2, wheel->notes[i], 0x7f);
+		if (mask & flagson)
+			wheel->noteson |= mask & wheel->noteonly;
+		if ((mask & wheel->noteonly) && (mask & flagsoff)) {
+			dm2_note(dm2, wheel->notes[i], 0x00);
+			wheel->noteson &= ~mask;
+		}
+	}
+
+	// Mid key
+	if ((wheel->midpressed & ~currmid) && wheel->midrel && wheel->wheelused) {
+		dm2_note(dm2, wheel->midrel, 0x7f);
+	}
+
+	// Releases
+	releases &= ~DM2_CLR;
+	newlight = wheel->whenreleased & releases;
+	if (!(wheel->exclusive && newlight)) newlight |= wheel->light & ~releases;
+	newlight = (newlight & ~DM2_CLR) | DM2_MID(currmid);
+	wheel->whenreleased &= ~releases;
+
+	// Keys which are masked out as toggles
+	newlight = ((newlight & ~wheel->notoggle) |
+		    (curr & wheel->notoggle));
+
+	// Bottom keypress: reset values
+	reset = (presses & DM2_CLR);
+	if (flagson || (currmid & ~wheel->midpressed)) wheel->wheelused = 0;
+	if ((wheel->pressed ^ curr) & DM2_CLR) wheel->wheelused = 1;
+
+	// Other presses
+	presses = (presses & ~DM2_CLR) | DM2_MID(~wheel->midpressed & currmid);
+	wheel->whenreleased = ((wheel->whenreleased & ~presses) |
+			       (~newlight & presses));
+	newlight |= presses;
+	wheel->light = newlight;
+	wheel->pressed = curr;
+	wheel->midpressed = currmid;
+	trace_dm2_wheel_update(wheel - dm2->wheels, prevpressed, curr, prevmid,
+			       currmid, newlight, wheel->whenreleased);
+
+	// Reset values
+	if (!reset) return;
+	for (bits = newlight & wheel->parammask; bits; bits &= bits - 1) {
+		i = dm2_ctz(bits);
+		if ((wheel->midivals[i] == 64) && !wheel->midilsbs[i]) continue;
+		wheel->midivals[i] = 64;
+		wheel->midilsbs[i] = 0;
+		dm2_cc(dm2, wheel->params[i], wheel->midivals[i]);
+	}
+}
+
+/* Move an absolute param by midiadd steps, or hiadd 1/128 steps in hires mode */
+static void dm2_wheel_param(struct dm2 *dm2, struct dm2wheel *wheel, int i,
+			    int midiadd, int hiadd)
+{
+	int value;
+
+	if (wheel->hires && (wheel->params[i] < 32)) {
+		value = (wheel->midivals[i] << 7) + wheel->midilsbs[i] + hiadd;
+		value = (value < 0) ? 0 : (value > 16383) ? 16383 : value;
+		if (dm2->ump && (value != (wheel->midivals[i] << 7) + wheel->midilsbs[i]))
+			dm2_ump_send(dm2, DM2_UMP_CC, wheel->params[i], dm2_ump_scale(value, 14));
+		dm2_send14(dm2, wheel->params[i], &(wheel->midivals[i]),
+			   &(wheel->midilsbs[i]), value);
+		return;
+	}
+	value = wheel->midivals[i] + midiadd;
+	value = (value < 0) ? 0 : (value > 127) ? 127: value;
+	if (value != wheel->midivals[i]) {
+		dm2_cc(dm2, wheel->params[i], value);
+		wheel->midivals[i] = value;
+	}
+}
+
+static void dm2_wheel_turn(struct dm2 *dm2, struct dm2wheel *wheel, u8 step)
+{
+	int acc, midiadd, hiadd = 0, i, diff, thresh, reldiff;
+	u8 params;
+	unsigned int bits;
+
+	diff = step;
+	if (step & 0x80) diff-=256;
+	diff = -diff;
+
+	// Calculate step for relative mode
+	// reldiff = diff += 64;
+	// reldiff = (reldiff < 0) ? 0 : (reldiff > 127) ? 127: reldiff;
+
+	// Platter position counts raw ticks in every mode and wraps around
+	wheel->pos = (wheel->pos + diff) & 0x3fff;
+
+	// Jog wheel mode
+	if (!(wheel->pressed || wheel->light || wheel->midpressed)) {
+		// The position is only sent here, where it moves the deck
+		if (wheel->posparam && (wheel->pos != (wheel->posmsb << 7) + wheel->poslsb)) {
+			dm2_send14(dm2, wheel->posparam, &(wheel->posmsb), &(wheel->poslsb),
+				   wheel->pos);
+			if (dm2->ump)
+				dm2_ump_send(dm2, DM2_UMP_CC, wheel->posparam,
+					     dm2_ump_scale(wheel->pos, 14));
+		}
+		reldiff = dm2_jog_accel(dm2, diff);
+		trace_dm2_wheel_turn(wheel - dm2->wheels, diff, 0, reldiff,
+				     wheel->pressed, wheel->light);
+		diff = reldiff;
+		// UMP takes the whole delta, MIDI 1.0 needs it in pieces
+		if (dm2->ump && diff)
+			dm2_ump_send(dm2, DM2_UMP_RELATIVE, wheel->jogparam, (u32)diff);
+		reldiff = diff;
+		if (reldiff != 0) {
+			do {
+				int trnc = (reldiff < -64) ? -64 : (reldiff > 63) ? 63 : reldiff;
+				dm2_midi_send(dm2, 0xb0, wheel->jogparam, trnc+64);
+				wheel->jogmidival = trnc+64;
+				reldiff -= trnc;
+			} while (reldiff);
+		} else {
+			if (wheel->jogmidival != 64)
+				dm2_midi_send(dm2, 0xb0, wheel->jogparam, 64);
+			wheel->jogmidival = 64;
+		}
+		return;
+	}
+
+	// Adjust stepping accumulator (for absolute CCs and cursor motion)
+	thresh = wheel->paramthresh;
+	if (wheel->midpressed && (wheel->midup || wheel->middown))
+		thresh = wheel->cursorthresh;
+	acc = wheel->turnacc;
+	acc += diff;
+	midiadd = acc / thresh;
+	wheel->turnacc = acc % thresh;
+	if (wheel->hires) {
+		acc = wheel->hiacc + diff*128;
+		hiadd = acc / thresh;
+		wheel->hiacc = acc % thresh;
+	}
+	trace_dm2_wheel_turn(wheel - dm2->wheels, diff, wheel->turnacc, midiadd,
+			     wheel->pressed, wheel->light);
+	// if (!midiadd && !wheel->relparams) return;
+
+	wheel->showlight = 1;
+	wheel->wheelused = 1;
+
+	// Mid key pressed: only mid parameter / cursor
+	if (wheel->midpressed) {
+		if (wheel->midup || wheel->middown) {
+			if ((midiadd < 0) && wheel->middown) {
+				for (i=0; i<-midiadd; i++)
+					dm2_note(dm2, wheel->middown, 0x7f);
+			}
+			if ((midiadd > 0) && wheel->midup) {
+				for (i=0; i<midiadd; i++)
+					dm2_note(dm2, wheel->midup, 0x7f);
+			}
+			return;
+		}
+		if (wheel->params[DM2_MIDINDEX]) {
+			dm2_wheel_param(dm2, wheel, DM2_MIDINDEX, midiadd, hiadd);
+			return;
+		}
+	}
+
+	// Use presses, then lights
+	params = wheel->pressed;
+	if (params) {
+		params = wheel->pressed;
+		wheel->whenreleased = wheel->light & ~params;
+	} else {
+		params = wheel->light;		
+	}
+
+	// Transmit params
+	for (bits = params & wheel->parammask; bits; bits &= bits - 1) {
+		i = dm2_ctz(bits);
+		if (wheel->relparams & (1 << i)) {
+			if (dm2->ump && diff)
+				dm2_ump_send(dm2, DM2_UMP_RELATIVE, wheel->params[i], (u32)diff);
+			reldiff = diff;
+			if (reldiff != 0) {
+				do {
+					int trnc = (reldiff < -64) ? -64 : (reldiff > 63) ? 63 : reldiff;
+					dm2_midi_send(dm2, 0xb0, wheel->params[i], trnc+64);
+					wheel->midivals[i] = trnc+64;
+					reldiff -= trnc;
+				} while (reldiff);
+			} else {
+				if (wheel->midivals[i] != 64)
+					dm2_midi_send(dm2, 0xb0, wheel->params[i], 64);
+				wheel->midivals[i] = 64;
+			}
+		} else {
+			dm2_wheel_param(dm2, wheel, i, midiadd, hiadd);
+		}
+	}
+	return;
+}
+
+static void dm2_buttons_map(struct dm2buttons *buttons, const u8 notes[8])
+{
+	int i;
+
+	buttons->notemask = 0;
+	memcpy(buttons->notes, notes, 8*sizeof(u8));
+	for (i=0; i<8; i++)
+		if (notes[i]) buttons->notemask |= 1 << i;
+}
+
+static void dm2_buttons_init(struct dm2buttons *buttons)
+{
+	buttons->pressed = 0;
+}
+
+static void dm2_buttons_update(struct dm2 *dm2, struct dm2buttons *buttons, u8 curr)
+{
+	unsigned int bits;
+	int i;
+
+	bits = (buttons->pressed ^ curr) & buttons->notemask;
+	buttons->pressed = curr;
+	for (; bits; bits &= bits - 1) {
+		i = dm2_ctz(bits);
+		dm2_note(dm2, buttons->notes[i], ((curr >> i) & 1) ? 0x7f : 0x00);
+	}
+	return;
+}
+
+static void dm2_leds_map(struct dm2leds *leds, const u8 notes[8], u8 idlenote)
+{
+	memcpy(leds->notes, notes, 8*sizeof(u8));
+	leds->idlenote = idlenote;
+}
+
+static void dm2_leds_init(struct dm2leds *leds)
+{
+	leds->timeout = 0;
+	leds->idletimeout = leds->wheeltimeout = 0;
+	leds->curr = leds->mask = leds->light = 0;
+	leds->idlelight = leds->wheel = 0;
+}
+
+static void dm2_leds_timer(struct dm2leds *leds, int elapsed)
+{
+	// Handle idle loop
+	if (leds->idlelight) {
+		if (leds->idletimeout <= 0) {
+			leds->idletimeout += DM2_LEDIDLEINT*1000;
+			leds->idlelight >>= 1;
+			if (!leds->idlelight) leds->idlelight = 0x80;
+		}
+		leds->idletimeout -= elapsed;
+	}
+
+	// Handle mask timeout
+	if (leds->wheeltimeout > 0) leds->wheeltimeout -= elapsed;
+	if (leds->wheeltimeout < 0) leds->wheeltimeout = 0;
+	if (leds->timeout <= 0) return;
+	leds->timeout -= elapsed;
+	if (leds->timeout > 0) return;
+	leds->timeout = 0;
+	leds->mask = leds->light = 0;
+}
+
+static int dm2_leds_active(struct dm2leds *leds)
+{
+	return leds->timeout || leds->wheeltimeout || leds->idlelight;
+}
+
+#ifdef UNUSED_FUNCTIONS
+static void dm2_leds_overlay(struct dm2leds *leds, u8 mask, u8 light)
+{
+	leds->timeout = DM2_LEDTIMEOUT*1000;
+	leds->mask |= mask;
+	leds->light = (leds->light & ~mask) | (light & mask);
+}
+#endif
+
+/* Every note refreshes the overlay timeout, also when it has no LED */
+static void dm2_leds_note(struct dm2leds *leds, u8 mask, int idle, u8 vel)
+{
+	leds->timeout = DM2_LEDTIMEOUT*1000;
+	if (vel) leds->light |= mask;
+	else     leds->light &= ~mask;
+	leds->mask |= mask;
+	if (idle)
+		leds->idlelight = vel ? 0x80 : 0;
+}
+
+static void dm2_ledmap_init(struct dm2 *dm2)
+{
+	struct dm2leds *leds;
+	int bank, i;
+
+	memset(dm2->ledmap, 0, sizeof(dm2->ledmap));
+	for (bank=0; bank<2; bank++) {
+		leds = &(dm2->leds[bank]);
+		for (i=0; i<8; i++)
+			dm2->ledmap[leds->notes[i] & 0x7f].mask[bank] |= 1 << i;
+		dm2->ledmap[leds->idlenote & 0x7f].idle |= 1 << bank;
+	}
+}
+
+static void dm2_leds_send(struct dm2 *dm2)
+{
+	int i, send = 0;
+	u8 new[2];
+	struct dm2leds *leds;
+
+	for (i=0; i<2; i++) {
+		// Handle timing of LED layers
+		leds = &(dm2->leds[i]);
+		if ((dm2->wheels[i].light != leds->wheel) ||
+		    dm2->wheels[i].showlight || dm2->wheels[i].light) {
+			leds->wheeltimeout = DM2_LEDTIMEOUT*1000;
+			leds->wheel = dm2->wheels[i].light;
+			dm2->wheels[i].showlight = 0;
+		}
+		// Merge layers
+		new[i] = leds->wheeltimeout ? leds->wheel : leds->idlelight;
+		new[i] = ((new[i] & ~leds->mask) | (leds->light & leds->mask));
+		if (leds->curr == new[i]) continue;
+		leds->curr = new[i];
+		send = 1;
+	}
+
+	if (send) dm2_set_leds(dm2, new[0], new[1]);
+}
+
+/* Note on/off and CC from the host switch LEDs on both banks */
+void dm2_leds_update(struct dm2 *dm2, u8 note, u8 vel)
+{
+	const struct dm2ledmap *map = &(dm2->ledmap[note & 0x7f]);
+
+	dm2_leds_note(&(dm2->leds[0]), map->mask[0], map->idle & 1, vel);
+	dm2_leds_note(&(dm2->leds[1]), map->mask[1], map->idle & 2, vel);
+}
+
+/* MIDI from the host, a buffer at a time and cut anywhere. Note on, */
+/* note off and CC switch LEDs right here, the rest goes through */
+/* dm2_midi_command(). The LEDs change with the next dm2_leds_frame(). */
+void dm2_midi_parse(struct dm2 *dm2, struct dm2parser *p, const u8 *buf, int len)
+{
+	u8 byte, cmd;
+
+	for (; len > 0; buf++, len--) {
+		byte = *buf;
+		if (!(byte & 0x80)) {
+			if (p->sysex) {
+				if (p->sysexlen < DM2_SYSEXSIZE)
+					p->sysexbuf[p->sysexlen++] = byte;
+				else
+					p->sysex = 2;
+				continue;
+			}
+			if (!p->rstatus) continue;
+			p->args[p->nargs++] = byte;
+			cmd = p->rstatus & 0xf0;
+			if (cmd == 0xc0) {
+				p->nargs = 0;
+				dm2_midi_command(dm2, p->rstatus, p->args, 1);
+			} else if (p->nargs == 2) {
+				p->nargs = 0;
+				dm2_leds_update(dm2, p->args[0], (cmd == 0x80) ? 0 : p->args[1]);
+			}
+			continue;
+		}
+
+		// Real time bytes may come anywhere, reset ends everything
+		if (byte == 0xff) {
+			p->rstatus = p->nargs = 0;
+			p->sysex = 0;
+			dm2_midi_command(dm2, byte, NULL, 0);
+			continue;
+		}
+		if (byte >= 0xf8) continue;
+		if (p->sysex) {
+			if (p->sysex == 1 && byte == 0xf7)
+				dm2_midi_command(dm2, 0xf0, p->sysexbuf, p->sysexlen);
+			else
+				dm2->counters.badsysex++;
+			p->sysex = 0;
+			if (byte == 0xf7) continue;
+		}
+		p->rstatus = p->nargs = 0;
+		if (byte == 0xf0) {
+			p->sysex = 1;
+			p->sysexlen = 0;
+			continue;
+		}
+		if (p->chan && ((byte & 0x0f) != p->chan)) continue;
+		cmd = byte & 0xf0;
+		if ((cmd == 0x80) || (cmd == 0x90) || (cmd == 0xb0) || (cmd == 0xc0))
+			p->rstatus = byte;
+	}
+}
+
+/* Advance the LED layers by elapsed us and send what changed. */
+/* Returns nonzero while a timeout or the idle loop is running. */
+int dm2_leds_frame(struct dm2 *dm2, int elapsed)
+{
+	if (elapsed) {
+		dm2_leds_timer(&(dm2->leds[0]), elapsed);
+		dm2_leds_timer(&(dm2->leds[1]), elapsed);
+	}
+	dm2_leds_send(dm2);
+	return dm2_leds_active(&(dm2->leds[0])) || dm2_leds_active(&(dm2->leds[1]));
+}
+
+
+/* Main event handler */
+
+void dm2_report(struct dm2 *dm2, const u8 *curr, u32 now)
+{
+	int i;
+	u8 prev[10];
+
+	dm2->now = now;
+
+	// Slider initialization with fancy LED blinking.
+	if (dm2->initialize==38) dm2_set_leds(dm2, 0xaa, 0x55);
+	if (dm2->initialize==25) dm2_set_leds(dm2, 0x55, 0xaa);
+	if (dm2->initialize==12) dm2_set_leds(dm2, 0xff, 0xff);
+	if (dm2->initialize==1)  dm2_set_leds(dm2, 0x00, 0x00);
+	if (dm2->initialize && (!--dm2->initialize)) {
+		for (i=0; i<3; i++) dm2_slider_reset(&(dm2->sliders[i]), curr[i+5]);
+		dm2_set_leds(dm2, 0, 0);
+	}
+
+	// Nothing works until initialization is complete!
+	if (dm2->initialize) return;
+
+	memcpy(prev, dm2->prev_state, 10*sizeof(u8));
+
+
+	// byte 0, 1: handle right and left shift buttons.
+	if ((curr[1] != prev[1]) || (curr[3] != prev[3]))
+		dm2_wheel_update(dm2, &(dm2->wheels[0]), curr[1], curr[3]);
+	if ((curr[0] != prev[0]) || (curr[3] != prev[3]))
+		dm2_wheel_update(dm2, &(dm2->wheels[1]), curr[0], curr[3]);
+
+	// byte 2, 3: handle top and bottom normal buttons.
+	if (curr[2] != prev[2]) dm2_buttons_update(dm2, &(dm2->buttons[0]), curr[2]);
+	if (curr[3] != prev[3]) dm2_buttons_update(dm2, &(dm2->buttons[1]), curr[3]);
+
+	// bytes 5, 6, 7: handle sliders.
+	for (i=0; i<3; i++)
+		if ((curr[i+5] != prev[i+5]) || dm2->sliders[i].settling)
+			dm2_slider_update(dm2, &(dm2->sliders[i]), curr[i+5]);
+
+	// bytes 8, 9: handle wheels.
+	if (curr[8] || prev[8]) dm2_wheel_turn(dm2, &(dm2->wheels[0]), curr[8]);
+	if (curr[9] || prev[9]) dm2_wheel_turn(dm2, &(dm2->wheels[1]), curr[9]);
+
+	memcpy(dm2->prev_state, curr, 10*sizeof(u8));
+
+#if 0
+	// Print current status in hex.
+	{
+		int i;
+		printk("received: ");
+		for (i=0; i<10; i++) printk( "%02x ", curr[i] );
+		printk( "\n" );
+	}
+#endif
+}
+
+
+/* Time passing without reports: send slider moves whose interval */
+/* has ended and let the smoothing settle. Returns nonzero while */
+/* something is still waiting. */
+int dm2_tick(struct dm2 *dm2, u32 now)
+{
+	struct dm2slider *slider;
+	int i, busy = 0;
+
+	if (dm2->initialize) return 0;
+	dm2->now = now;
+	for (i=0; i<3; i++) {
+		slider = &(dm2->sliders[i]);
+		if (slider->settling)
+			dm2_slider_update(dm2, slider, dm2->prev_state[i+5]);
+		if (slider->pending && (!slider->last ||
+					((u32)(now - slider->last) >= slider->interval)))
+			dm2_slider_emit(dm2, slider, dm2->prev_state[i+5]);
+		busy |= slider->settling || slider->pending;
+	}
+	return busy;
+}
+
+
+/* Every control as it stands, for a host that wants to catch up */
+/* without waiting for each one to move: sliders, absolute params, */
+/* platter positions and the notes of the keys held down. */
+
+static void dm2_dump_cc(struct dm2 *dm2, u8 param, int value, int hires)
+{
+	if (hires) {
+		dm2_midi_send(dm2, 0xb0, param, value >> 7);
+		dm2_midi_send(dm2, 0xb0, param + 32, value & 0x7f);
+	} else {
+		dm2_midi_send(dm2, 0xb0, param, value);
+	}
+	if (dm2->ump) dm2_ump_send(dm2, DM2_UMP_CC, param, dm2_ump_scale(value, hires ? 14 : 7));
+}
+
+void dm2_dump(struct dm2 *dm2)
+{
+	struct dm2slider *slider;
+	struct dm2wheel *wheel;
+	unsigned int bits;
+	int i, w, value;
+
+	if (dm2->initialize) return;
+	for (i=0; i<3; i++) {
+		slider = &(dm2->sliders[i]);
+		value = slider->lut[slider->pos];
+		slider->midival = slider->hires ? value >> 7 : value;
+		slider->midilsb = slider->hires ? value & 0x7f : 0;
+		slider->pending = 0;
+		dm2_midi_send(dm2, 0xb0, slider->param, slider->midival);
+		if (slider->hires) dm2_midi_send(dm2, 0xb0, slider->param + 32, slider->midilsb);
+		if (!dm2->ump) continue;
+		slider->umpval = dm2_slider_value(slider, slider->pos, 16);
+		dm2_ump_send(dm2, DM2_UMP_CC, slider->param, dm2_ump_scale(slider->umpval, 16));
+	}
+
+	for (w=0; w<2; w++) {
+		wheel = &(dm2->wheels[w]);
+		for (bits = wheel->parammask & ~wheel->relparams; bits; bits &= bits - 1) {
+			i = dm2_ctz(bits);
+			if (wheel->hires && (wheel->params[i] < 32))
+				dm2_dump_cc(dm2, wheel->params[i],
+					    (wheel->midivals[i] << 7) + wheel->midilsbs[i], 1);
+			else
+				dm2_dump_cc(dm2, wheel->params[i], wheel->midivals[i], 0);
+		}
+		if (wheel->posparam)
+			dm2_dump_cc(dm2, wheel->posparam, wheel->pos, 1);
+		for (bits = wheel->noteson; bits; bits &= bits - 1)
+			dm2_note(dm2, wheel->notes[dm2_ctz(bits)], 0x7f);
+		wheel->posmsb = wheel->pos >> 7;
+		wheel->poslsb = wheel->pos & 0x7f;
+	}
+
+	for (w=0; w<2; w++)
+		for (bits = dm2->buttons[w].pressed & dm2->buttons[w].notemask; bits;
+		     bits &= bits - 1)
+			dm2_note(dm2, dm2->buttons[w].notes[dm2_ctz(bits)], 0x7f);
+}
+
+/* Note off for every note that is on, with the mapping that sent it, */
+/* before dm2_load_preset() changes the mapping. Releasing the keys */
+/* later sends note off for their new notes, which is harmless. */
+void dm2_notes_off(struct dm2 *dm2)
+{
+	struct dm2wheel *wheel;
+	unsigned int bits;
+	int w;
+
+	if (dm2->initialize) return;
+	for (w=0; w<2; w++) {
+		wheel = &(dm2->wheels[w]);
+		for (bits = wheel->noteson; bits; bits &= bits - 1)
+			dm2_note(dm2, wheel->notes[dm2_ctz(bits)], 0x00);
+		wheel->noteson = 0;
+	}
+	for (w=0; w<2; w++)
+		for (bits = dm2->buttons[w].pressed & dm2->buttons[w].notemask; bits;
+		     bits &= bits - 1)
+			dm2_note(dm2, dm2->buttons[w].notes[dm2_ctz(bits)], 0x00);
+}
+
+
+/* Swap the mapping of a preset in. Calibration, keys held and lit, */
+/* param values and LEDs stay as they are, so this can happen */
+/* between two reports. */
+
+void dm2_load_preset(struct dm2 *dm2, const struct dm2_params *params)
+{
+	struct dm2slider *slider;
+	int i;
+
+	for (i=0; i<3; i++) {
+		slider = &(dm2->sliders[i]);
+		dm2_slider_map(slider, params->sliderparam[i], params->sliderdeadzone,
+			       (params->hires >> i) & 1, params->sliderhyst[i],
+			       params->sliderfilter[i], params->sliderinterval[i]);
+		// A wider dead zone has to fit into the calibrated range
+		if (slider->min > slider->mid - slider->dead - 1)
+			slider->min = slider->mid - slider->dead - 1;
+		if (slider->max && (slider->max < slider->mid + slider->dead + 1))
+			slider->max = slider->mid + slider->dead + 1;
+		dm2_slider_calibrate(slider);
+	}
+
+	dm2_wheel_map(&(dm2->wheels[0]), params->wheel0notes, params->wheel0params,
+		      params->wheel0jogparam, params->midup0, params->middown0,
+		      params->midrel0, params->excl0, params->relparams0,
+		      params->notoggle0, params->paramthresh, params->cursorthresh,
+		      (params->hires >> 3) & 1, params->jogpos0);
+	dm2_wheel_map(&(dm2->wheels[1]), params->wheel1notes, params->wheel1params,
+		      params->wheel1jogparam, params->midup1, params->middown1,
+		      params->midrel1, params->excl1, params->relparams1,
+		      params->notoggle1, params->paramthresh, params->cursorthresh,
+		      (params->hires >> 4) & 1, params->jogpos1);
+	dm2_jogtab_init(dm2, params->jogcurve);
+
+	dm2_buttons_map(&(dm2->buttons[0]), params->buttons0);
+	dm2_buttons_map(&(dm2->buttons[1]), params->buttons1);
+
+	dm2_leds_map(&(dm2->leds[0]), params->led0notes, params->led0idle);
+	dm2_leds_map(&(dm2->leds[1]), params->led1notes, params->led1idle);
+	dm2_ledmap_init(dm2);
+}
+
+
+/* Is CC param sent by any control of the preset, as MSB or alone? */
+static int dm2_params_usecc(const struct dm2_params *p, int param)
+{
+	int i;
+
+	for (i=0; i<3; i++)
+		if (p->sliderparam[i] == param) return 1;
+	for (i=0; i<8; i++)
+		if ((p->wheel0params[i] == param) || (p->wheel1params[i] == param))
+			return 1;
+	return (p->wheel0jogparam == param) || (p->wheel1jogparam == param) ||
+		(p->jogpos0 == param) || (p->jogpos1 == param);
+}
+
+/* A 14 bit control on param n sends its LSB on n+32 */
+static int dm2_params_hires(const struct dm2_params *p, int param)
+{
+	return (param >= 32) || dm2_params_usecc(p, param + 32);
+}
+
+/* Combinations a preset can hold but the core cannot send, see hires */
+/* in dm2core.h. Returns NULL if the preset is fine, or what is wrong. */
+const char *dm2_params_check(const struct dm2_params *p)
+{
+	int i;
+
+	// dm2_wheel_turn() divides by them
+	if (!p->paramthresh || !p->cursorthresh) return "wheel thresholds must not be 0";
+	if (p->hires & ~0x1f) return "unknown hires bits";
+	if ((p->jogpos0 && dm2_params_hires(p, p->jogpos0)) ||
+	    (p->jogpos1 && dm2_params_hires(p, p->jogpos1)))
+		return "jogpos needs a param below 32 whose LSB param is free";
+	for (i=0; i<3; i++)
+		if (((p->hires >> i) & 1) && dm2_params_hires(p, p->sliderparam[i]))
+			return "14 bit slider needs a param below 32 whose LSB param is free";
+	for (i=0; i<8; i++) {
+		if (((p->hires >> 3) & 1) && p->wheel0params[i] &&
+		    dm2_params_hires(p, p->wheel0params[i]))
+			return "14 bit wheel needs params below 32 whose LSB params are free";
+		if (((p->hires >> 4) & 1) && p->wheel1params[i] &&
+		    dm2_params_hires(p, p->wheel1params[i]))
+			return "14 bit wheel needs params below 32 whose LSB params are free";
+	}
+	return NULL;
+}
+
+
+/* Check a preset file and copy its presets out, unless presets is */
+/* NULL. Every value has to be a 7 bit value, as in a SysEx message, */
+/* and every preset has to pass dm2_params_check(). Returns the number */
+/* of presets, or -1 if the file is not valid. */
+
+int dm2_presets_parse(const u8 *data, size_t len, struct dm2_params *presets)
+{
+	const struct dm2_presetfile *head = (const struct dm2_presetfile *)data;
+	struct dm2_params params;
+	size_t i;
+	int n;
+
+	if (len < sizeof(*head)) return -1;
+	if (memcmp(head->magic, DM2_PRESETMAGIC, 4) ||
+	    (head->version != DM2_PRESETVERSION)) return -1;
+	if (!head->count || (head->count > DM2_MAXPRESETS)) return -1;
+	if (!head->size || (head->size > sizeof(struct dm2_params))) return -1;
+	if (len != sizeof(*head) + (size_t)head->count * head->size) return -1;
+	for (i = sizeof(*head); i < len; i++)
+		if (data[i] & 0x80) return -1;
+
+	data += sizeof(*head);
+	for (n=0; n<head->count; n++) {
+		memset(&params, 0, sizeof(params));
+		memcpy(&params, data, head->size);
+		data += head->size;
+		if (dm2_params_check(&params)) return -1;
+		if (presets) presets[n] = params;
+	}
+	return head->count;
+}
+
+
+/* Stored slider calibration. Restoring it ends the start up */
+/* countdown, so the next report is handled right away. Returns -1 */
+/* and changes nothing if a range does not fit around the dead zone. */
+
+void dm2_calibration_get(struct dm2 *dm2, struct dm2_calibration calib[3])
+{
+	int i;
+
+	for (i=0; i<3; i++) {
+		calib[i].min = dm2->sliders[i].min;
+		calib[i].mid = dm2->sliders[i].mid;
+		calib[i].max = dm2->sliders[i].max;
+	}
+}
+
+int dm2_calibration_restore(struct dm2 *dm2, const struct dm2_calibration calib[3])
+{
+	struct dm2slider *slider;
+	int i;
+
+	for (i=0; i<3; i++) {
+		slider = &(dm2->sliders[i]);
+		if (calib[i].min + slider->dead + 1 > calib[i].mid) return -1;
+		if (!slider->max != !calib[i].max) return -1;
+		if (calib[i].max && (calib[i].mid + slider->dead + 1 > calib[i].max))
+			return -1;
+	}
+	for (i=0; i<3; i++) {
+		slider = &(dm2->sliders[i]);
+		dm2_slider_reset(slider, calib[i].mid);
+		slider->min = calib[i].min;
+		slider->max = calib[i].max;
+		dm2_slider_calibrate(slider);
+	}
+	if (dm2->initialize) {
+		dm2->initialize = 0;
+		dm2_set_leds(dm2, 0, 0);
+	}
+	return 0;
+}
+
+
+/* Initialize DM2 structure */
+
+void dm2_internal_init(struct dm2 *dm2, const struct dm2_params *params)
+{
+	int i;
+
+	memset(dm2->prev_state, 0, 10*sizeof(u8));
+	dm2->initialize = 50;
+	dm2_load_preset(dm2, params);
+	for (i=0; i<3; i++)
+		dm2_slider_init(&(dm2->sliders[i]), (i==2) ? 0 : 1);
+
+	dm2_wheel_init(&(dm2->wheels[0]));
+	dm2_wheel_init(&(dm2->wheels[1]));
+	dm2_buttons_init(&(dm2->buttons[0]));
+	dm2_buttons_init(&(dm2->buttons[1]));
+	dm2_leds_init(&(dm2->leds[0]));
+	dm2_leds_init(&(dm2->leds[1]));
+	return;
+}
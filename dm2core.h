@@ -0,0 +1,303 @@
+/*
+ * dm2core.h  -  Mixman DM2 state machines, shared by driver and tools
+ *
+ *
+ * Copyright (C) 2007-2008 Jan Jockusch (jan@jockusch.de)
+ * Copyright (C) 2006-2007 Andre Roth <lynx@netlabs.org>
+ *
+ *	This program is free software; you can redistribute it and/or
+ *	modify it under the terms of the GNU General Public License as
+ *	published by the Free Software Foundation, version 2.
+ *
+ */
+
+/* Everything that turns DM2 reports into MIDI and MIDI into LED */
+/* states lives in dm2core.c. It knows nothing about USB or ALSA and */
+/* also builds in userspace, see tools/dm2bench.c. */
+
+#ifndef _DM2CORE_H
+#define _DM2CORE_H
+
+#ifdef __KERNEL__
+#include <linux/types.h>
+#else
+#include <stddef.h>
+#include <stdint.h>
+typedef uint8_t u8;
+typedef uint16_t u16;
+typedef uint32_t u32;
+#endif
+
+#define DM2_REPORTLEN 10
+
+/* Structure with complete parameter set for a DM2. */
+/* Use this to encode program sets and to set the */
+/* SysEx message. All values are thus 7 bit values! */
+
+struct dm2_params {
+	// Slider parameters:  X  Y  Fader
+	u8 sliderparam[3];
+
+	u8 sliderdeadzone;
+	// Slider jitter filter:  X  Y  Fader
+	u8 sliderhyst[3];	// Reversals up to this many raw units are dropped
+	u8 sliderfilter[3];	// IIR smoothing, pos += (raw - pos) / 2^n, 0: off
+	u8 sliderinterval[3];	// ms between messages, moves in between merged
+	u8 paramthresh;
+	u8 cursorthresh;
+
+	u8 wheel0jogparam;
+	u8 wheel1jogparam;
+	// Wheel button Notes/Params:  NW   W  SW   S  SE   E  NE   N
+	u8 wheel0notes[8];
+	u8 wheel0params[8];
+	u8 wheel1notes[8];
+	u8 wheel1params[8];
+	// Use parameters in relative mode: nn NW  W  SW  SE  E  NE  N
+	u8 relparams0, relparams1;
+	// Disable toggle mode on which keys: nn NW  W  SW  SE  E  NE  N
+	u8 notoggle0, notoggle1;
+	// First button set: Stop  Play  Rec  T3  T2  T1   R   L
+	u8 buttons0[8];
+	// Second button set: nn Mid  B  A  B4  B3  B2  B1
+	u8 buttons1[8];
+	// Mid button up/down keys, on-release keys
+	u8 midup0, middown0, midup1, middown1, midrel0, midrel1;
+	// Exclusive mode? (only one param at a time)
+	u8 excl0, excl1;
+
+	// Notes to activate LEDs: NW  W  SW  S  SE  E  NE  N
+	u8 led0notes[8];
+	u8 led1notes[8];
+	// Activate/deactivate idle loop
+	u8 led0idle, led1idle;
+	// 14 bit CCs (MSB n, LSB n+32, for n < 32): nn nn nn Wheel1 Wheel0 Fader Y X
+	// Every param of a control set here has to be below 32, and n+32 must
+	// not be a param of another control. Preset files and SysEx presets
+	// that break this are refused, see dm2_params_check(). The built-in
+	// presets use 32-39 for wheel1, which are also the LSBs of their
+	// sliders, so they need other params for any 14 bit control.
+	u8 hires;
+	// Jog acceleration: steps sent for 1, 2, 4, 8, 16, 32, 64, 128
+	// ticks per report, interpolated in between. All 0: ticks as they are.
+	u8 jogcurve[8];
+	// 14 bit absolute platter position (MSB n, LSB n+32, n < 32 as for
+	// hires), 0: off. Counts every tick, but is only sent while jogging.
+	u8 jogpos0, jogpos1;
+};
+
+/* How to parameterize LED keys:
+ *
+ * allowed combination       meaning
+ * notoggle note  param
+ * off      set   unset      press: note on, lock. 2nd release: note off, unlock
+ * on       set   unset      press: note on; release: note off.
+ * off      unset set        press: wheel into param mode, lock. 2nd release: unlock
+ * on       unset set        press: wheel into param mode. release: nothing
+ * off      set   set        press: wheel into param mode, lock. 2nd release: note on if wheel turned, unlock
+ * on       set   set        press: wheel into param mode. release: note on if no wheel turn.
+ *
+ * A key that locks does not when the wheel is turned while it is held.
+ * tools/dm2test.c checks every row.
+ */
+
+/* A curve for scratching, slow turns stay fine grained and fast ones
+ * cover ground:
+ *
+ *   .jogcurve = { 1, 2, 3, 6, 14, 32, 80, 127 },
+ */
+
+#define DM2_NUMPRESETS 3
+extern struct dm2_params dm2_params[DM2_NUMPRESETS];
+
+/* Preset files, to load presets at run time: this header, then count
+ * presets of size bytes, each struct dm2_params field by field. Files
+ * written before fields were added load with those fields 0, and are
+ * refused if that breaks dm2_params_check() (e.g. thresholds of 0).
+ */
+#define DM2_PRESETMAGIC "DM2P"
+#define DM2_PRESETVERSION 1
+#define DM2_MAXPRESETS 128		/* One per program change */
+
+struct dm2_presetfile {
+	char			magic[4];	/* DM2_PRESETMAGIC */
+	u8			version;	/* DM2_PRESETVERSION */
+	u8			count;		/* Presets, 1 to DM2_MAXPRESETS */
+	u8			size;		/* sizeof(struct dm2_params) of the writer */
+	u8			reserved;
+};
+
+
+struct dm2slider {
+	u8			pos;		/* Current position */
+	u8			min, max, mid;	/* Values for auto-calibration */
+	u8			dead;		/* Dead zone width in slider units */
+	u8			param;
+	u8			midival;
+	u8			hires;		/* Send 14 bit, param+32 carries the LSB */
+	u8			midilsb;
+	int			umpval;		/* Last 16 bit value sent as UMP */
+
+	u8			hyst;		/* Reversals this small are jitter */
+	u8			filter;		/* IIR shift, 0 disables */
+	u8			settling;	/* Filter has not reached the raw value */
+	u8			pending;	/* Move waiting for the interval to end */
+	int			dir;		/* Direction of the last accepted move */
+	int			filt;		/* Filtered position, 8.8 fixed point */
+	u32			interval;	/* Minimum time between messages in us */
+	u32			last;		/* Time of the last message */
+
+	u16			lut[256];	/* Raw position to 7 or 14 bit value */
+};
+
+
+/* Learned range of a slider, to start with instead of calibrating */
+struct dm2_calibration {
+	u8			min, mid, max;	/* max is 0 for the fader, which mirrors min */
+};
+
+
+#define DM2_MIDINDEX 3
+#define DM2_MIDMASK 0x02
+#define DM2_CLR 0x08
+#define DM2_MID(v) (((v)&DM2_MIDMASK)<<2)
+
+
+struct dm2wheel {
+	u8			pressed;	/* Map of pressed keys */
+	u8			light;		/* Which are locked now */
+	u8			whenreleased;	/* Which state to assume when released */
+	u8			notes[8];	/* Note to be used for each button. 0 disables. */
+	u8			params[8];	/* Param for controller. 0 disables. */
+	u8			noteonly;	/* Keys with a note and no param */
+	u8			noteparam;	/* Keys with both */
+	u8			noteson;	/* Note-only keys whose note is on */
+	u8			parammask;	/* Keys with a param */
+	u8			midivals[8];
+	u8			midilsbs[8];	/* LSBs of absolute params in hires mode */
+	u8			relparams;	/* Params which send relative values. */
+	u8			notoggle;      	/* Buttons which do not toggle. */
+	u8			exclusive;	/* Only one param active at a time */
+	u8			hires;		/* 14 bit absolute params, for params < 32 */
+
+	u8			paramthresh;	/* Wheel turn threshold for adjusting parameters */
+	u8			cursorthresh;	/* Wheel turn threshold for adjusting the cursor */
+
+	u8			jogparam;
+	u8			jogmidival;
+	u8			posparam;	/* Platter position CC, 0 disables */
+	u8			posmsb, poslsb;
+	u8			midpressed;
+
+	u8			midup;		/* If set: "up" key while mid is pressed */
+	u8			middown;	/* If set: "down" key while mid id pressed */
+	u8			midrel;		/* If set: key pressed when mid is released */
+	u8			wheelused;	/* Set if wheel has turned while holding a key */
+
+	int			showlight;	/* Make sure lights are shown */
+	int			turnacc;	/* Turn accumulator before increment is done. */
+	int			hiacc;		/* Same in 1/128 steps, for hires */
+	int			pos;		/* Platter position in ticks, 14 bit */
+};
+
+
+struct dm2buttons {
+	u8			pressed;
+	u8			notemask;	/* Buttons with a note */
+	u8			notes[8];
+};
+
+#define DM2_LEDIDLEINT 200		/* ms */
+#define DM2_LEDTIMEOUT 1000		/* ms */
+
+/* What a note from the host does to the LEDs, see dm2_leds_update() */
+struct dm2ledmap {
+	u8			mask[2];		/* LEDs of each bank it switches */
+	u8			idle;			/* Bit n: switches idle loop of bank n */
+};
+
+struct dm2leds {
+	int			timeout;		/* remaining duration of overlay in us */
+	int			wheeltimeout;		/* Wheel should show through, in us */
+	int			idletimeout;		/* Delay between idle loop advances, in us */
+	u8			curr;			/* current setting */
+	u8			wheel;			/* Setting from the wheel buttons */
+	u8			mask;			/* LEDs masked by foreign input */
+	u8			light;			/* Light setting not from wheels */
+	u8			idlelight;		/* State of the idle loop */
+	u8			notes[8];		/* Note on/off that we interpret */
+	u8			idlenote;		/* Note that switches the idle loop */
+};
+
+
+/* Output that the filters kept back, for tuning them */
+struct dm2counters {
+	unsigned long		suppressed;	/* Slider moves dropped as jitter */
+	unsigned long		merged;		/* Slider moves replaced by a later one */
+	unsigned long		badsysex;	/* SysEx messages too long or cut off */
+};
+
+#define DM2_SYSEXSIZE 256		/* Longest SysEx message taken, without F0/F7 */
+
+/* MIDI from one host port, between two dm2_midi_parse() calls */
+struct dm2parser {
+	u8			chan;		/* Only this channel, 0: any */
+	u8			rstatus;	/* Running status, 0: data is ignored */
+	u8			nargs;
+	u8			args[2];
+	int			sysex;		/* 1: in a SysEx message, 2: too long */
+	int			sysexlen;
+	u8			sysexbuf[DM2_SYSEXSIZE];
+};
+
+struct dm2 {
+	u8			prev_state[10];
+	u32			now;		/* Time of the report being processed, us */
+	struct dm2slider	sliders[3];
+	int			initialize;	/* Signals that the pots have to be initalized */
+
+	struct dm2wheel		wheels[2];
+	int			jogcurve;	/* jogtab is in use */
+	u8			jogtab[129];	/* Jog steps by ticks per report */
+	struct dm2buttons	buttons[2];
+	struct dm2leds		leds[2];
+	struct dm2ledmap	ledmap[128];	/* By note, built from the leds */
+
+	int			ump;		/* Also send through dm2_ump_send() */
+	struct dm2counters	counters;
+};
+
+
+/* Engine, in dm2core.c */
+void dm2_internal_init(struct dm2 *dm2, const struct dm2_params *params);
+void dm2_load_preset(struct dm2 *dm2, const struct dm2_params *params);
+int dm2_presets_parse(const u8 *data, size_t len, struct dm2_params *presets);
+const char *dm2_params_check(const struct dm2_params *p);
+void dm2_calibration_get(struct dm2 *dm2, struct dm2_calibration calib[3]);
+int dm2_calibration_restore(struct dm2 *dm2, const struct dm2_calibration calib[3]);
+void dm2_report(struct dm2 *dm2, const u8 *curr, u32 now);
+int dm2_tick(struct dm2 *dm2, u32 now);
+void dm2_dump(struct dm2 *dm2);
+void dm2_notes_off(struct dm2 *dm2);
+void dm2_midi_parse(struct dm2 *dm2, struct dm2parser *p, const u8 *buf, int len);
+void dm2_leds_update(struct dm2 *dm2, u8 note, u8 vel);
+int dm2_leds_frame(struct dm2 *dm2, int elapsed);
+
+/* MIDI 2.0 messages for dm2_ump_send(). Every event also goes to */
+/* dm2_midi_send(), in 7 or 14 bit. */
+#define DM2_UMP_NOTEOFF		0x80	/* index: note */
+#define DM2_UMP_NOTEON		0x90	/* index: note, value: 16 bit velocity */
+#define DM2_UMP_CC		0xb0	/* index: param, value: 32 bit */
+#define DM2_UMP_RELATIVE	0x50	/* Relative assignable controller in bank 0, */
+					/* index: param, value: signed 32 bit delta */
+
+/* Output hooks, provided by whoever embeds struct dm2 */
+void dm2_midi_send(struct dm2 *dm2, u8 cmd, u8 param, u8 value);
+void dm2_ump_send(struct dm2 *dm2, u8 cmd, u8 index, u32 value);
+void dm2_set_leds(struct dm2 *dm2, u8 left, u8 right);
+/* Host messages that are not LED feedback, from dm2_midi_parse(): */
+/* program change (data: program), SysEx (status 0xf0, data: without */
+/* F0/F7) and reset (0xff, no data) */
+void dm2_midi_command(struct dm2 *dm2, u8 status, const u8 *data, int len);
+
+#endif /* _DM2CORE_H */
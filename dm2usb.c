@@ -0,0 +1,2010 @@
+/*
+ * dm2usb.c  -  Mixman DM2 stateful MIDI driver, USB and ALSA glue
+ *
+ *
+ * Copyright (C) 2007-2008 Jan Jockusch (jan@jockusch.de)
+ * Copyright (C) 2006-2008 Andre Roth <lynx@netlabs.org>
+ * Copyright (C) 2001-2004 Greg Kroah-Hartman (greg@kroah.com)
+ *
+ *	This program is free software; you can redistribute it and/or
+ *	modify it under the terms of the GNU General Public License as
+ *	published by the Free Software Foundation, version 2.
+ *
+ * $Id: dm2.c,v 1.53 2008/03/04 10:55:10 jan Exp $
+ *
+ */
+
+/*
+ * TODO
+ *
+ * Note on / note off on primary and secondary beat: reset LED position,
+ * then advance one position on every secondary beat.
+ * CC on a channel: light the LEDs in a VU meter pattern.
+ *
+ * MIDI configuration (done): F0 7D 01 <struct dm2_params> F7 programs
+ * all keys and buttons, reset (0xff) brings back the default mode.
+ * F0 7D 02 F7 calls all controller settings, like the BCD 3000 does.
+ * 
+ */
+
+#include <linux/kernel.h>
+#include <linux/errno.h>
+#include <linux/init.h>
+#include <linux/slab.h>
+#include <linux/module.h>
+#include <linux/kref.h>
+#include <asm/uaccess.h>
+#include <linux/usb.h>
+#include <linux/spinlock.h>
+#include <linux/version.h>
+#include <linux/ktime.h>
+#include <linux/hrtimer.h>
+#include <linux/interrupt.h>
+#include <linux/workqueue.h>
+#include <linux/kthread.h>
+#include <linux/wait.h>
+#include <linux/sched.h>
+#include <linux/debugfs.h>
+#include <linux/seq_file.h>
+#include <linux/math64.h>
+#include <linux/firmware.h>
+
+#include <sound/core.h>
+#include <sound/rawmidi.h>
+#include <sound/initval.h>
+#include <sound/asequencer.h>
+#include <sound/seq_kernel.h>
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(6,5,0)
+#include <sound/ump.h>
+#endif
+
+#include "dm2.h"
+
+#define CREATE_TRACE_POINTS
+#include "dm2_trace.h"
+
+static int index = SNDRV_DEFAULT_IDX1;	/* Index 0-MAX */
+static char *id = SNDRV_DEFAULT_STR1;	/* ID for this card */
+
+module_param(index, int, 0444);
+MODULE_PARM_DESC(index, "Index value for DM2 MIDI controller.");
+module_param(id, charp, 0444);
+MODULE_PARM_DESC(id, "ID string for DM2 MIDI controller.");
+
+static int inurbs = 2;			/* Input URBs in flight */
+
+module_param(inurbs, int, 0444);
+MODULE_PARM_DESC(inurbs, "Number of input URBs kept in flight (1-8).");
+
+static int ledfps = 100;		/* LED animation frame rate */
+
+module_param(ledfps, int, 0444);
+MODULE_PARM_DESC(ledfps, "Frame rate of LED timeouts and idle loop in Hz (10-1000).");
+
+static bool seq = 0;			/* Register a sequencer client */
+
+module_param(seq, bool, 0444);
+MODULE_PARM_DESC(seq, "Also deliver events through a native, time-stamped sequencer port.");
+
+static bool ump = 0;			/* Register a MIDI 2.0 endpoint */
+
+module_param(ump, bool, 0444);
+MODULE_PARM_DESC(ump, "Also register a MIDI 2.0 (UMP) endpoint with full resolution values (Linux 6.5+).");
+
+static int calibration[9];		/* Slider ranges, instead of calibrating */
+static int ncalibration;
+
+module_param_array(calibration, int, &ncalibration, 0644);
+MODULE_PARM_DESC(calibration, "Slider ranges to start with instead of calibrating: min,mid,max of X, Y and fader (fader max 0).");
+
+static int context = DM2_CTX_TASKLET;	/* Where reports are processed */
+static int rtprio = 50;			/* Priority of the processing thread */
+
+module_param(context, int, 0444);
+MODULE_PARM_DESC(context, "Processing context: 0 tasklet, 1 inline in URB completion, 2 BH workqueue, 3 thread.");
+module_param(rtprio, int, 0444);
+MODULE_PARM_DESC(rtprio, "SCHED_FIFO priority of the processing thread (1-99, context=3 only; ignored from Linux 5.9 on, use chrt).");
+
+static const char *dm2_ctxnames[DM2_NUMCTX] = { "tasklet", "inline", "workqueue", "thread" };
+
+static struct usb_driver dm2_driver;
+static struct dentry *dm2_debugfs_root;
+
+// Make kernel version check
+#if LINUX_VERSION_CODE < KERNEL_VERSION(2,6,22)
+#  warning This driver will not compile for kernels older than 2.6.22
+#endif
+#if LINUX_VERSION_CODE < KERNEL_VERSION(2,6,24)
+#  warning Please make sure your kernel is patched with linux-lowspeedbulk.patch
+#  define USE_BULK_SNDPIPE 1
+#endif
+// Kernel API compatibility
+#if LINUX_VERSION_CODE < KERNEL_VERSION(2,6,30)
+static inline
+int snd_card_create(int idx, const char *id,
+		    struct module *module, int extra_size,
+		    struct snd_card **card_ret)
+{
+	*card_ret = snd_card_new(idx, id, module, extra_size);
+	if (!(*card_ret)) return -1;
+	return 0;
+}
+#endif
+#if LINUX_VERSION_CODE < KERNEL_VERSION(3,17,0)
+#  define timespec64		timespec
+#  define ktime_to_timespec64	ktime_to_timespec
+#endif
+#if LINUX_VERSION_CODE < KERNEL_VERSION(3,6,0)
+#  define system_highpri_wq	system_wq
+#endif
+#if LINUX_VERSION_CODE < KERNEL_VERSION(5,15,0)
+#  define FW_ACTION_UEVENT	FW_ACTION_HOTPLUG
+#endif
+#if LINUX_VERSION_CODE < KERNEL_VERSION(6,12,0)
+// Older kernels log a missing optional file like any other
+#  define firmware_request_nowait_nowarn(mod, name, dev, gfp, ctx, cont) \
+	request_firmware_nowait(mod, FW_ACTION_UEVENT, name, dev, gfp, ctx, cont)
+#endif
+#if LINUX_VERSION_CODE < KERNEL_VERSION(6,9,0)
+#  define DM2_WQ		system_highpri_wq
+#else
+#  define DM2_WQ		system_bh_highpri_wq
+#endif
+#if defined(CONFIG_SND_SEQUENCER) || defined(CONFIG_SND_SEQUENCER_MODULE)
+#  define USE_SEQ 1
+#endif
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(6,5,0) && \
+    (defined(CONFIG_SND_UMP) || defined(CONFIG_SND_UMP_MODULE))
+#  define USE_UMP 1
+#endif
+#ifndef smp_mb__after_atomic
+#  define smp_mb__after_atomic()	smp_mb()
+#endif
+#ifndef READ_ONCE
+#  define READ_ONCE(x)		ACCESS_ONCE(x)
+#  define WRITE_ONCE(x, val)	(ACCESS_ONCE(x) = (val))
+#endif
+
+#define err(format, arg...) printk(KERN_ERR KBUILD_MODNAME ": " format "\n" , ## arg)
+#define info(format, arg...) printk(KERN_INFO KBUILD_MODNAME ": " format "\n" , ## arg)
+
+
+/* Report ring: producer side runs in the URB completion, */
+/* consumer side in dm2_process(). */
+
+static int dm2_ring_put(struct dm2ring *ring, const u8 *buf, ktime_t time)
+{
+	unsigned int head = ring->head;
+	struct dm2report *report;
+
+	if (head - READ_ONCE(ring->tail) >= DM2_RINGSIZE)
+		return -ENOSPC;
+	report = &(ring->reports[head & (DM2_RINGSIZE-1)]);
+	report->time = time;
+	memcpy(report->data, buf, DM2_REPORTLEN);
+	smp_wmb();	/* Publish the entry before the new head */
+	WRITE_ONCE(ring->head, head + 1);
+	return 0;
+}
+
+static struct dm2report *dm2_ring_peek(struct dm2ring *ring)
+{
+	unsigned int tail = ring->tail;
+
+	if (tail == READ_ONCE(ring->head))
+		return NULL;
+	smp_rmb();	/* Read the entry only after seeing the head */
+	return &(ring->reports[tail & (DM2_RINGSIZE-1)]);
+}
+
+static void dm2_ring_next(struct dm2ring *ring)
+{
+	smp_mb();	/* Done with the entry before handing it back */
+	WRITE_ONCE(ring->tail, ring->tail + 1);
+}
+
+/* LED animation clock. Runs at ledfps while any LED layer has a */
+/* timeout or the idle loop is on, or slider moves wait in the */
+/* filters, and stops otherwise. The timer only counts frames, */
+/* dm2_process() does the actual work. */
+
+static void dm2_schedule(struct usb_dm2 *dev);
+
+static enum hrtimer_restart dm2_ledclock(struct hrtimer *timer)
+{
+	struct usb_dm2 *dev = container_of(timer, struct usb_dm2, ledclock);
+
+	if (test_bit(DM2_LEDCLOCK_STOPPED, &dev->ledflags))
+		return HRTIMER_NORESTART;
+	if (!READ_ONCE(dev->ledactive)) {
+		clear_bit(DM2_LEDCLOCK_RUNNING, &dev->ledflags);
+		smp_mb();
+		// Somebody may have started an animation just now.
+		if (!READ_ONCE(dev->ledactive) ||
+		    test_and_set_bit(DM2_LEDCLOCK_RUNNING, &dev->ledflags))
+			return HRTIMER_NORESTART;
+	}
+
+	atomic_add(hrtimer_forward_now(timer, dev->ledperiod), &dev->ledticks);
+	dm2_schedule(dev);
+	return HRTIMER_RESTART;
+}
+
+static void dm2_ledclock_kick(struct usb_dm2 *dev)
+{
+	WRITE_ONCE(dev->ledactive, 1);
+	smp_mb();
+	if (test_bit(DM2_LEDCLOCK_STOPPED, &dev->ledflags))
+		return;
+	if (!test_and_set_bit(DM2_LEDCLOCK_RUNNING, &dev->ledflags))
+		hrtimer_start(&dev->ledclock, dev->ledperiod, HRTIMER_MODE_REL);
+}
+
+static void dm2_ledclock_init(struct usb_dm2 *dev)
+{
+	int fps = ledfps;
+
+	if (fps < 10) fps = 10;
+	if (fps > 1000) fps = 1000;
+	dev->ledperiod = ns_to_ktime(NSEC_PER_SEC / fps);
+	atomic_set(&dev->ledticks, 0);
+#if LINUX_VERSION_CODE < KERNEL_VERSION(6,15,0)
+	hrtimer_init(&dev->ledclock, CLOCK_MONOTONIC, HRTIMER_MODE_REL);
+	dev->ledclock.function = dm2_ledclock;
+#else
+	hrtimer_setup(&dev->ledclock, dm2_ledclock, CLOCK_MONOTONIC, HRTIMER_MODE_REL);
+#endif
+}
+
+static void dm2_ledclock_stop(struct usb_dm2 *dev)
+{
+	set_bit(DM2_LEDCLOCK_STOPPED, &dev->ledflags);
+	hrtimer_cancel(&dev->ledclock);
+}
+
+/* Program change: swap the mapping before the next report. Notes */
+/* still on are switched off with the old mapping first. */
+static void dm2_preset_apply(struct usb_dm2 *dev, int preset)
+{
+	const struct dm2_params *params;
+	u64 latency;
+
+	smp_rmb();	/* presetstamp was written before presetreq */
+	dev->dm2midi.stamp = dev->presetstamp;
+	if (preset == DM2_SYSEXPRESET)
+		params = &(dev->sysexparams);
+	else if (preset < dev->npresets)
+		params = &(dev->presets[preset]);
+	else
+		return;		/* Table was replaced meanwhile */
+	dm2_notes_off(&(dev->dm2));
+	dm2_load_preset(&(dev->dm2), params);
+	dev->preset = preset;
+
+	latency = ktime_to_ns(ktime_sub(ktime_get(), dev->presetstamp));
+	dev->stats.preset_switches++;
+	dev->stats.preset_lat_last = latency;
+	if (latency > dev->stats.preset_lat_max) dev->stats.preset_lat_max = latency;
+}
+
+/* One processing pass: all queued reports, then the LED frames. */
+static void dm2_process_pass(struct usb_dm2 *dev)
+{
+	struct dm2report *report;
+	int ticks, elapsed, active, req;
+
+	dev->stats.passes++;
+
+	// Host MIDI first: a program change applies to the reports below.
+	// What the host causes, like a dump, carries the time of its
+	// request and stays out of the latency figures.
+	dev->dm2midi.hostout = 1;
+	dm2_host_parse(dev);
+	req = atomic_xchg(&dev->presetreq, 0);
+	if (req) dm2_preset_apply(dev, req - 1);
+	dev->dm2midi.hostout = 0;
+
+	// Handle every report in order of arrival.
+	while ((report = dm2_ring_peek(&dev->ring))) {
+		// A program change that came in meanwhile waits for the
+		// next pass, this report still gets the old preset.
+		if (atomic_read(&dev->presetreq))
+			dev->stats.preset_late++;
+		dev->dm2midi.stamp = report->time;
+		dm2_report(&(dev->dm2), report->data, (u32)ktime_to_us(report->time));
+		dm2_ring_next(&dev->ring);
+	}
+
+	// Nothing works until initialization is complete!
+	if (!dev->dm2.initialize) {
+		// Advance LED timers by the frames the clock has counted.
+		ticks = atomic_xchg(&dev->ledticks, 0);
+		elapsed = ticks * (int)ktime_to_us(dev->ledperiod);
+		active = dm2_leds_frame(&(dev->dm2), elapsed);
+		// Merged slider moves are sent on the same clock.
+		active |= dm2_tick(&(dev->dm2), (u32)ktime_to_us(ktime_get()));
+		if (active)
+			dm2_ledclock_kick(dev);
+		else
+			WRITE_ONCE(dev->ledactive, 0);
+	}
+
+	// Hand everything from this pass to ALSA at once.
+	dm2_midi_flush(dev);
+}
+
+/* Only the inline context runs passes in hard interrupts. Everywhere */
+/* else proclock just has to keep out the softirq, so interrupts stay */
+/* enabled while a pass runs. */
+static int dm2_proc_trylock(struct usb_dm2 *dev, unsigned long *flags)
+{
+	if (dev->context == DM2_CTX_INLINE)
+		return spin_trylock_irqsave(&dev->proclock, *flags);
+	*flags = 0;
+	return spin_trylock_bh(&dev->proclock);
+}
+
+static void dm2_proc_lock(struct usb_dm2 *dev, unsigned long *flags)
+{
+	if (dev->context == DM2_CTX_INLINE)
+		spin_lock_irqsave(&dev->proclock, *flags);
+	else {
+		*flags = 0;
+		spin_lock_bh(&dev->proclock);
+	}
+}
+
+static void dm2_proc_unlock(struct usb_dm2 *dev, unsigned long flags)
+{
+	if (dev->context == DM2_CTX_INLINE)
+		spin_unlock_irqrestore(&dev->proclock, flags);
+	else
+		spin_unlock_bh(&dev->proclock);
+}
+
+/* Can be called from any context, also concurrently. Whoever holds */
+/* proclock runs another pass for callers that could not get it. */
+static void dm2_process(struct usb_dm2 *dev)
+{
+	unsigned long flags;
+
+	set_bit(DM2_PROC_AGAIN, &dev->procflags);
+	// The request must be seen by a holder that is about to unlock.
+	smp_mb__after_atomic();
+	while (test_bit(DM2_PROC_AGAIN, &dev->procflags)) {
+		if (!dm2_proc_trylock(dev, &flags))
+			return;
+		clear_bit(DM2_PROC_AGAIN, &dev->procflags);
+		smp_mb__after_atomic();
+		dm2_process_pass(dev);
+		dm2_proc_unlock(dev, flags);
+		// Pairs with the barrier after set_bit() above.
+		smp_mb();
+	}
+}
+
+static void dm2_tasklet(unsigned long arg)
+{
+	dm2_process((struct usb_dm2 *)arg);
+}
+
+static void dm2_work(struct work_struct *work)
+{
+	dm2_process(container_of(work, struct usb_dm2, work));
+}
+
+static int dm2_thread(void *arg)
+{
+	struct usb_dm2 *dev = arg;
+
+	while (!kthread_should_stop()) {
+		wait_event_interruptible(dev->procwait,
+					 test_and_clear_bit(DM2_PROC_WAKE, &dev->procflags) ||
+					 kthread_should_stop());
+		dm2_process(dev);
+	}
+	return 0;
+}
+
+/* Trigger dm2_process() in the configured context */
+static void dm2_schedule(struct usb_dm2 *dev)
+{
+	if (test_bit(DM2_PROC_STOPPED, &dev->procflags))
+		return;
+	switch (dev->context) {
+	case DM2_CTX_INLINE:
+		dm2_process(dev);
+		break;
+	case DM2_CTX_WORK:
+		queue_work(DM2_WQ, &dev->work);
+		break;
+	case DM2_CTX_THREAD:
+		set_bit(DM2_PROC_WAKE, &dev->procflags);
+		wake_up(&dev->procwait);
+		break;
+	default:
+		tasklet_schedule(&dev->dm2midi.tasklet);
+	}
+}
+
+static int dm2_context_init(struct usb_dm2 *dev)
+{
+	struct task_struct *thread;
+#if LINUX_VERSION_CODE < KERNEL_VERSION(5,9,0)
+	struct sched_param param;
+#endif
+
+	dev->context = context;
+	if ((dev->context < 0) || (dev->context >= DM2_NUMCTX))
+		dev->context = DM2_CTX_TASKLET;
+	spin_lock_init(&dev->proclock);
+	tasklet_init(&dev->dm2midi.tasklet, dm2_tasklet, (unsigned long)dev );
+	INIT_WORK(&dev->work, dm2_work);
+	init_waitqueue_head(&dev->procwait);
+
+	if (dev->context != DM2_CTX_THREAD) return 0;
+	thread = kthread_run(dm2_thread, dev, "dm2");
+	if (IS_ERR(thread)) return PTR_ERR(thread);
+#if LINUX_VERSION_CODE < KERNEL_VERSION(5,9,0)
+	param.sched_priority = (rtprio < 1) ? 1 : (rtprio > 99) ? 99 : rtprio;
+	sched_setscheduler(thread, SCHED_FIFO, &param);
+#else
+	// Modules can no longer pick the priority, use chrt on "dm2".
+	sched_set_fifo(thread);
+#endif
+	dev->thread = thread;
+	return 0;
+}
+
+static void dm2_context_stop(struct usb_dm2 *dev)
+{
+	set_bit(DM2_PROC_STOPPED, &dev->procflags);
+	tasklet_kill(&dev->dm2midi.tasklet);
+	cancel_work_sync(&dev->work);
+	if (dev->thread) {
+		kthread_stop(dev->thread);
+		dev->thread = NULL;
+	}
+}
+
+
+
+/* URB writing interface */
+
+static int dm2_write(struct usb_dm2 *dev);
+void dm2_set_leds(struct dm2 *dm2, u8 left, u8 right)
+{
+	struct usb_dm2 *dev = container_of(dm2, struct usb_dm2, dm2);
+	unsigned long flags;
+	u8 *data;
+
+	// Only the latest state matters. It always goes into the back
+	// buffer, replacing anything that has not been sent yet.
+	spin_lock_irqsave(&dev->lock, flags);
+	data = dev->int_out_urbs[dev->int_out_next]->transfer_buffer;
+	data[0] = 0xff ^ right; data[1] = 0xff ^ left;
+	data[2] = data[3] = 0xff;
+	if (dev->int_out_pending) dev->stats.leds_merged++;
+	dev->int_out_pending = 1;
+	if (!dev->int_out_busy) dm2_write(dev);
+	spin_unlock_irqrestore(&dev->lock, flags);
+}
+
+/* Basic interpretation of received URBs */
+
+static void dm2_update_status(struct usb_dm2 *dev, u8 *buf, int length, ktime_t time)
+{
+	// ATTENTION: Called in interrupt context!
+
+	dev->stats.reports++;
+	if (length != DM2_REPORTLEN) {
+		dev->stats.badlength++;
+		err("Unexpected URB length!");
+		return;
+	}
+
+	// Invert X joystick axis.
+	buf[5] = ~buf[5];
+
+	// Queue report for processing. If it is lagging this far behind,
+	// drop the new report rather than reorder.
+	if (dm2_ring_put(&dev->ring, buf, time)) {
+		dev->stats.overruns++;
+		if (printk_ratelimit())
+			err("Input ring full, report dropped (%lu so far)",
+			    dev->stats.overruns);
+	}
+
+	// Trigger further processing.
+	dm2_schedule(dev);
+
+	return;
+}
+
+
+/* MIDI from the host goes through one hostbuf per port to the next */
+/* processing pass, which parses all of it in one go. Each port has */
+/* its own running status and SysEx state, so a message cut short on */
+/* one port does not swallow the bytes of another. Writers hold */
+/* hostlock, the pass is the only reader. */
+
+static unsigned int dm2_host_space(struct dm2hostbuf *host, unsigned int head)
+{
+	unsigned int free = DM2_HOSTBUFSIZE - (head - READ_ONCE(host->tail));
+	unsigned int contig = DM2_HOSTBUFSIZE - (head & (DM2_HOSTBUFSIZE-1));
+
+	return min(free, contig);
+}
+
+static void dm2_host_publish(struct dm2hostbuf *host, unsigned int head)
+{
+	host->stamp = ktime_get();
+	smp_wmb();	/* Publish the bytes before the new head */
+	WRITE_ONCE(host->head, head);
+}
+
+/* Everything the rawmidi output substream holds, in as few pieces */
+/* as the buffers allow. If hostbuf fills up, the pass drains again. */
+static void dm2_host_drain(struct usb_dm2 *dev)
+{
+	struct dm2midi *dm2midi = &(dev->dm2midi);
+	struct dm2hostbuf *host = &(dm2midi->host[DM2_HOST_RAWMIDI]);
+	unsigned int head, space = 1;
+	unsigned long flags;
+	int n, total = 0;
+
+	spin_lock_irqsave(&dm2midi->hostlock, flags);
+	head = host->head;
+	while (dm2midi->output && (space = dm2_host_space(host, head))) {
+		n = snd_rawmidi_transmit(dm2midi->output,
+					 host->buf + (head & (DM2_HOSTBUFSIZE-1)), space);
+		if (n <= 0) break;
+		head += n;
+		total += n;
+		dev->stats.hostdrains++;
+	}
+	if (total) dm2_host_publish(host, head);
+	if (!space) set_bit(DM2_PROC_HOSTFULL, &dev->procflags);
+	spin_unlock_irqrestore(&dm2midi->hostlock, flags);
+
+	if (total || !space) dm2_schedule(dev);
+}
+
+/* Messages from the sequencer and UMP ports */
+static void dm2_host_write(struct usb_dm2 *dev, int port, const u8 *buf, int len)
+{
+	struct dm2midi *dm2midi = &(dev->dm2midi);
+	struct dm2hostbuf *host = &(dm2midi->host[port]);
+	unsigned int head, n;
+	unsigned long flags;
+
+	spin_lock_irqsave(&dm2midi->hostlock, flags);
+	head = host->head;
+	while (len > 0) {
+		n = min_t(unsigned int, dm2_host_space(host, head), len);
+		if (!n) {
+			dev->stats.hostdropped += len;
+			break;
+		}
+		memcpy(host->buf + (head & (DM2_HOSTBUFSIZE-1)), buf, n);
+		head += n;
+		buf += n;
+		len -= n;
+	}
+	dm2_host_publish(host, head);
+	spin_unlock_irqrestore(&dm2midi->hostlock, flags);
+
+	dm2_schedule(dev);
+}
+
+/* Called by dm2_process_pass(), under proclock */
+static void dm2_host_parse(struct usb_dm2 *dev)
+{
+	struct dm2midi *dm2midi = &(dev->dm2midi);
+	struct dm2hostbuf *host;
+	unsigned int tail, head, n;
+	int port;
+
+	for (port=0; port<DM2_NUMHOST; port++) {
+		host = &(dm2midi->host[port]);
+		tail = host->tail;
+		head = READ_ONCE(host->head);
+		if (tail == head) continue;
+		smp_rmb();	/* Read the bytes only after seeing the head */
+		dm2midi->hoststamp = dm2midi->stamp = host->stamp;
+		while (tail != head) {
+			n = min(head - tail, DM2_HOSTBUFSIZE - (tail & (DM2_HOSTBUFSIZE-1)));
+			dm2_midi_parse(&(dev->dm2), &(host->parser),
+				       host->buf + (tail & (DM2_HOSTBUFSIZE-1)), n);
+			dev->stats.hostbytes += n;
+			tail += n;
+		}
+		smp_mb();	/* Done with the bytes before handing them back */
+		WRITE_ONCE(host->tail, tail);
+	}
+	if (test_and_clear_bit(DM2_PROC_HOSTFULL, &dev->procflags))
+		dm2_host_drain(dev);
+}
+
+/* A complete SysEx message, without F0 and F7 */
+static void dm2_midi_sysex(struct usb_dm2 *dev, const u8 *msg, int len)
+{
+	struct dm2_params params;
+	const char *problem;
+
+	if ((len < 2) || (msg[0] != DM2_SYSEXID)) return;
+	switch (msg[1]) {
+	case DM2_SYSEX_PARAMS:
+		// Older senders may not know the last fields, they stay 0
+		if ((len < 3) || (len - 2 > sizeof(struct dm2_params))) {
+			dev->stats.sysex_bad++;
+			return;
+		}
+		memset(&params, 0, sizeof(params));
+		memcpy(&params, msg + 2, len - 2);
+		if ((problem = dm2_params_check(&params))) {
+			err("SysEx preset refused: %s", problem);
+			dev->stats.sysex_bad++;
+			return;
+		}
+		dev->sysexparams = params;
+		dev->presetstamp = dev->dm2midi.hoststamp;
+		dm2_preset_apply(dev, DM2_SYSEXPRESET);
+		break;
+	case DM2_SYSEX_DUMP:
+		dm2_dump(&(dev->dm2));
+		break;
+	default:
+		dev->stats.sysex_bad++;
+		return;
+	}
+	dev->stats.sysex++;
+}
+
+/* Host messages other than LED feedback, see dm2_midi_parse() */
+void dm2_midi_command(struct dm2 *dm2, u8 status, const u8 *data, int len)
+{
+	struct usb_dm2 *dev = container_of(dm2, struct usb_dm2, dm2);
+
+	switch (status & 0xf0) {
+	case 0xc0:
+		// Before the reports of this pass, see dm2_preset_apply()
+		dev->presetstamp = dev->dm2midi.hoststamp;
+		dm2_preset_apply(dev, data[0]);
+		return;
+	case 0xf0:
+		if (status == 0xf0) {
+			dm2_midi_sysex(dev, data, len);
+			return;
+		}
+		// perform reset
+		dev->dm2midi.out_rstatus = 0;
+		dm2_internal_init(&(dev->dm2), &(dev->presets[0]));
+		dm2_calibration_apply(dev);
+		dev->preset = 0;
+		return;
+	}
+}
+
+
+
+/* Midi functions */
+
+static int dm2_midi_input_open(struct snd_rawmidi_substream *substream)
+{
+	struct usb_dm2 *dev = substream->rmidi->private_data;
+ 	dev->dm2midi.input = substream;
+	/* Reset the current status */
+	dev->dm2midi.out_rstatus = 0;
+	/* increment our usage count for the device */
+	kref_get(&dev->kref);
+	return 0;
+}
+
+static int dm2_midi_input_close(struct snd_rawmidi_substream *substream)
+{
+	struct usb_dm2 *dev = substream->rmidi->private_data;
+	dev->dm2midi.input = NULL;
+	/* decrement the count on our device */
+	kref_put(&dev->kref, dm2_delete);
+	return 0;
+}
+
+static int dm2_midi_output_open(struct snd_rawmidi_substream *substream)
+{
+	struct usb_dm2 *dev = substream->rmidi->private_data;
+	dev->dm2midi.output = substream;
+	/* increment our usage count for the device */
+	kref_get(&dev->kref);
+	return 0;
+}
+
+static int dm2_midi_output_close(struct snd_rawmidi_substream *substream)
+{
+	struct usb_dm2 *dev = substream->rmidi->private_data;
+	unsigned long flags;
+
+	spin_lock_irqsave(&dev->dm2midi.hostlock, flags);
+	dev->dm2midi.output = NULL;
+	spin_unlock_irqrestore(&dev->dm2midi.hostlock, flags);
+	/* decrement the count on our device */
+	kref_put(&dev->kref, dm2_delete);
+	return 0;
+}
+
+static void dm2_midi_input_trigger(struct snd_rawmidi_substream *substream, int up)
+{
+	struct usb_dm2 *dev = substream->rmidi->private_data;
+	if (up)
+		dev->dm2midi.input_triggered = 1;
+	else
+		dev->dm2midi.input_triggered = 0;
+	// Should reschedule a tasklet which does snd_rawmidi_receive(substream, data, len) ?
+}
+
+/* Only takes the bytes, they are parsed by the next processing pass */
+static void dm2_midi_output_trigger(struct snd_rawmidi_substream *substream, int up)
+{
+	struct usb_dm2 *dev = substream->rmidi->private_data;
+
+	if (up) dm2_host_drain(dev);
+}
+
+static struct snd_rawmidi_ops dm2_midi_output = {
+	.open =		dm2_midi_output_open,
+	.close =	dm2_midi_output_close,
+	.trigger =	dm2_midi_output_trigger,
+};
+
+static struct snd_rawmidi_ops dm2_midi_input = {
+	.open = 	dm2_midi_input_open,
+	.close =	dm2_midi_input_close,
+	.trigger =	dm2_midi_input_trigger,
+};
+
+
+/* Sequencer client: decoded events go straight to the subscribers, */
+/* stamped with the completion time of the report that caused them, */
+/* or for a dump with the time the host asked for it. */
+
+#ifdef USE_SEQ
+static void dm2_seq_send(struct usb_dm2 *dev, u8 cmd, u8 param, u8 value)
+{
+	struct dm2midi *dm2midi = &(dev->dm2midi);
+	struct snd_seq_event ev;
+	struct timespec64 ts = ktime_to_timespec64(dm2midi->stamp);
+
+	memset(&ev, 0, sizeof(ev));
+	switch (cmd) {
+	case 0x90:
+		ev.type = SNDRV_SEQ_EVENT_NOTEON;
+		ev.data.note.channel = dm2midi->chan;
+		ev.data.note.note = param;
+		ev.data.note.velocity = value;
+		break;
+	case 0xb0:
+		ev.type = SNDRV_SEQ_EVENT_CONTROLLER;
+		ev.data.control.channel = dm2midi->chan;
+		ev.data.control.param = param;
+		ev.data.control.value = value;
+		break;
+	default:
+		return;
+	}
+	// Monotonic time of the URB completion. Subscriptions that ask
+	// for queue time stamps get them overwritten by the sequencer.
+	ev.flags = SNDRV_SEQ_TIME_STAMP_REAL | SNDRV_SEQ_TIME_MODE_ABS |
+		SNDRV_SEQ_EVENT_LENGTH_FIXED;
+	ev.time.time.tv_sec = ts.tv_sec;
+	ev.time.time.tv_nsec = ts.tv_nsec;
+	ev.queue = SNDRV_SEQ_QUEUE_DIRECT;
+	ev.source.port = dm2midi->seqport;
+	ev.dest.client = SNDRV_SEQ_ADDRESS_SUBSCRIBERS;
+	// dm2_process() may run in a tasklet or the URB completion
+	snd_seq_kernel_client_dispatch(dm2midi->seqclient, &ev, 1, 1);
+}
+
+/* Events written to our port are LED feedback, like on the rawmidi port. */
+static int dm2_seq_event_input(struct snd_seq_event *ev, int direct,
+			       void *private_data, int atomic, int hop)
+{
+	struct usb_dm2 *dev = private_data;
+	u8 sysex[DM2_SYSEXSIZE + 2];	/* With F0 and F7 */
+	unsigned long flags;
+	u8 msg[3];
+	int len = 3;
+
+	switch (ev->type) {
+	case SNDRV_SEQ_EVENT_NOTEON:
+	case SNDRV_SEQ_EVENT_NOTEOFF:
+		msg[0] = (ev->type == SNDRV_SEQ_EVENT_NOTEON) ? 0x90 : 0x80;
+		msg[0] |= ev->data.note.channel & 0x0f;
+		msg[1] = ev->data.note.note & 0x7f;
+		msg[2] = ev->data.note.velocity & 0x7f;
+		break;
+	case SNDRV_SEQ_EVENT_CONTROLLER:
+		msg[0] = 0xb0 | (ev->data.control.channel & 0x0f);
+		msg[1] = ev->data.control.param & 0x7f;
+		msg[2] = ev->data.control.value & 0x7f;
+		break;
+	case SNDRV_SEQ_EVENT_PGMCHANGE:
+		msg[0] = 0xc0 | (ev->data.control.channel & 0x0f);
+		msg[1] = ev->data.control.value & 0x7f;
+		len = 2;
+		break;
+	case SNDRV_SEQ_EVENT_RESET:
+		msg[0] = 0xff;
+		len = 1;
+		break;
+	case SNDRV_SEQ_EVENT_SYSEX:
+		// The whole message, F0 to F7. The data may be in user space
+		// or chained pool cells, so it is always copied out.
+		if ((ev->flags & SNDRV_SEQ_EVENT_LENGTH_MASK) != SNDRV_SEQ_EVENT_LENGTH_VARIABLE)
+			return 0;
+		len = snd_seq_expand_var_event(ev, sizeof(sysex), (char *)sysex, 1, 0);
+		if (len < 0) {
+			// Longer than any SysEx we take
+			spin_lock_irqsave(&dev->dm2midi.hostlock, flags);
+			dev->stats.hostdropped += ev->data.ext.len & ~SNDRV_SEQ_EXT_MASK;
+			spin_unlock_irqrestore(&dev->dm2midi.hostlock, flags);
+			return 0;
+		}
+		dm2_host_write(dev, DM2_HOST_SEQ, sysex, len);
+		return 0;
+	default:
+		return 0;
+	}
+	dm2_host_write(dev, DM2_HOST_SEQ, msg, len);
+	return 0;
+}
+
+static int dm2_seq_init(struct usb_dm2 *dev)
+{
+	struct dm2midi *dm2midi = &(dev->dm2midi);
+	struct snd_seq_port_callback pcallbacks;
+	char portname[] = "Mixman DM2";
+	int client, port;
+
+	// Index 0 belongs to the generic rawmidi client of this card.
+	client = snd_seq_create_kernel_client(dm2midi->card, 1, "Mixman DM2");
+	if (client < 0) return client;
+
+	memset(&pcallbacks, 0, sizeof(pcallbacks));
+	pcallbacks.owner = THIS_MODULE;
+	pcallbacks.private_data = dev;
+	pcallbacks.event_input = dm2_seq_event_input;
+	port = snd_seq_event_port_attach(client, &pcallbacks,
+					 SNDRV_SEQ_PORT_CAP_READ | SNDRV_SEQ_PORT_CAP_SUBS_READ |
+					 SNDRV_SEQ_PORT_CAP_WRITE | SNDRV_SEQ_PORT_CAP_SUBS_WRITE,
+					 SNDRV_SEQ_PORT_TYPE_MIDI_GENERIC | SNDRV_SEQ_PORT_TYPE_HARDWARE,
+					 16, 0, portname);
+	if (port < 0) {
+		snd_seq_delete_kernel_client(client);
+		return port;
+	}
+	dm2midi->seqport = port;
+	dm2midi->seqclient = client;
+	return 0;
+}
+
+static void dm2_seq_destroy(struct usb_dm2 *dev)
+{
+	if (dev->dm2midi.seqclient < 0) return;
+	snd_seq_delete_kernel_client(dev->dm2midi.seqclient);
+	dev->dm2midi.seqclient = -1;
+}
+#else
+static inline void dm2_seq_send(struct usb_dm2 *dev, u8 cmd, u8 param, u8 value) { }
+static inline int dm2_seq_init(struct usb_dm2 *dev) { return -ENODEV; }
+static inline void dm2_seq_destroy(struct usb_dm2 *dev) { }
+#endif
+
+
+/* MIDI 2.0 endpoint next to the rawmidi port. Sliders, wheel params */
+/* and jog deltas arrive from the core in full resolution, everything */
+/* else upscaled. Host messages are converted and parsed like on the */
+/* rawmidi port. */
+
+#ifdef USE_UMP
+#define DM2_UMPDEVICE	2	/* Rawmidi device number of the endpoint */
+
+/* Messages are collected in umpbuf, flushed with outbuf */
+void dm2_ump_send(struct dm2 *dm2, u8 cmd, u8 index, u32 value)
+{
+	struct usb_dm2 *dev = container_of(dm2, struct usb_dm2, dm2);
+	struct dm2midi *dm2midi = &(dev->dm2midi);
+	u32 *words;
+
+	if (dm2midi->umplen > DM2_UMPBUFSIZE - 2) dm2_midi_flush(dev);
+	words = dm2midi->umpbuf + dm2midi->umplen;
+	dm2midi->umplen += 2;
+
+	// MIDI 2.0 channel voice message in group 0
+	words[0] = 0x40000000 | ((cmd | dm2midi->chan) << 16);
+	switch (cmd) {
+	case DM2_UMP_NOTEON:
+	case DM2_UMP_NOTEOFF:
+		words[0] |= index << 8;
+		words[1] = value << 16;		/* no attribute */
+		break;
+	case DM2_UMP_RELATIVE:
+		words[0] |= index;		/* bank 0 */
+		words[1] = value;
+		break;
+	default:
+		words[0] |= index << 8;
+		words[1] = value;
+	}
+}
+
+static void dm2_ump_flush(struct usb_dm2 *dev)
+{
+	struct dm2midi *dm2midi = &(dev->dm2midi);
+
+	if (dm2midi->umplen && dm2midi->ump && READ_ONCE(dev->dm2.ump)) {
+		snd_ump_receive(dm2midi->ump, dm2midi->umpbuf, dm2midi->umplen * 4);
+		dev->stats.umpbytes += dm2midi->umplen * 4;
+	}
+	dm2midi->umplen = 0;
+}
+
+/* Packet length in words by message type */
+static int dm2_ump_words(u32 word)
+{
+	static const u8 words[16] = { 1, 1, 1, 2, 2, 4, 1, 1, 2, 2, 2, 3, 3, 4, 4, 4 };
+
+	return words[word >> 28];
+}
+
+/* Group 0 channel voice messages from the host, as MIDI 1.0 bytes */
+static void dm2_ump_process(struct usb_dm2 *dev, const u32 *words)
+{
+	u8 msg[3], status = (words[0] >> 16) & 0xff;
+	int len = 3;
+
+	if (words[0] & 0x0f000000) return;
+	msg[0] = status;
+	msg[1] = (words[0] >> 8) & 0x7f;
+	switch (words[0] >> 28) {
+	case 0x2:		/* MIDI 1.0 channel voice */
+		msg[2] = words[0] & 0x7f;
+		if ((status & 0xf0) == 0xc0) len = 2;
+		break;
+	case 0x4:		/* MIDI 2.0 channel voice */
+		switch (status & 0xf0) {
+		case 0x80:
+		case 0xb0:
+			msg[2] = words[1] >> 25;
+			break;
+		case 0x90:
+			// Velocity 0 is no note off in MIDI 2.0
+			msg[2] = words[1] >> 25;
+			if (!msg[2] && (words[1] >> 16)) msg[2] = 1;
+			break;
+		case 0xc0:
+			msg[1] = (words[1] >> 24) & 0x7f;
+			len = 2;
+			break;
+		default:
+			return;
+		}
+		break;
+	default:
+		return;
+	}
+	dm2_host_write(dev, DM2_HOST_UMP, msg, len);
+}
+
+static int dm2_ump_open(struct snd_ump_endpoint *ep, int dir)
+{
+	struct usb_dm2 *dev = ep->private_data;
+
+	if (dir == SNDRV_RAWMIDI_STREAM_INPUT) {
+		dev->dm2midi.umplen = 0;
+		WRITE_ONCE(dev->dm2.ump, 1);
+	} else {
+		dev->dm2midi.umpinlen = 0;
+	}
+	kref_get(&dev->kref);
+	return 0;
+}
+
+static void dm2_ump_close(struct snd_ump_endpoint *ep, int dir)
+{
+	struct usb_dm2 *dev = ep->private_data;
+
+	if (dir == SNDRV_RAWMIDI_STREAM_INPUT)
+		WRITE_ONCE(dev->dm2.ump, 0);
+	kref_put(&dev->kref, dm2_delete);
+}
+
+static void dm2_ump_trigger(struct snd_ump_endpoint *ep, int dir, int up)
+{
+	struct usb_dm2 *dev = ep->private_data;
+	struct dm2midi *dm2midi = &(dev->dm2midi);
+	u32 word;
+
+	if ((dir != SNDRV_RAWMIDI_STREAM_OUTPUT) || !up) return;
+	while (snd_ump_transmit(ep, &word, 4) == 4) {
+		dm2midi->umpin[dm2midi->umpinlen++] = word;
+		if (dm2midi->umpinlen < dm2_ump_words(dm2midi->umpin[0])) continue;
+		dm2_ump_process(dev, dm2midi->umpin);
+		dm2midi->umpinlen = 0;
+	}
+}
+
+static const struct snd_ump_ops dm2_ump_ops = {
+	.open =		dm2_ump_open,
+	.close =	dm2_ump_close,
+	.trigger =	dm2_ump_trigger,
+};
+
+/* Must run before snd_card_register(). The card frees the endpoint. */
+static int dm2_ump_init(struct usb_dm2 *dev)
+{
+	struct snd_ump_endpoint *ep;
+	struct snd_ump_block *fb;
+	int err;
+
+	err = snd_ump_endpoint_new(dev->dm2midi.card, "Mixman DM2 UMP", DM2_UMPDEVICE,
+				   1, 1, &ep);
+	if (err < 0) return err;
+	ep->private_data = dev;
+	ep->ops = &dm2_ump_ops;
+	strscpy(ep->info.name, "Mixman DM2", sizeof(ep->info.name));
+	ep->info.protocol_caps = SNDRV_UMP_EP_INFO_PROTO_MIDI2;
+	ep->info.protocol = SNDRV_UMP_EP_INFO_PROTO_MIDI2;
+	ep->info.flags = SNDRV_UMP_EP_INFO_STATIC_BLOCKS;
+	ep->info.num_blocks = 1;
+	dev->dm2midi.ump = ep;
+
+	// One function block on group 0, both directions
+	err = snd_ump_block_new(ep, 0, SNDRV_UMP_DIR_BIDIRECTION, 0, 1, &fb);
+	if (err < 0) return err;
+	strscpy(fb->info.name, "Mixman DM2", sizeof(fb->info.name));
+	fb->info.ui_hint = SNDRV_UMP_BLOCK_UI_HINT_BOTH;
+	fb->info.active = 1;
+	return 0;
+}
+#else
+void dm2_ump_send(struct dm2 *dm2, u8 cmd, u8 index, u32 value) { }
+static inline void dm2_ump_flush(struct usb_dm2 *dev) { }
+static inline int dm2_ump_init(struct usb_dm2 *dev) { return -ENODEV; }
+#endif
+
+
+/* Messages are collected in outbuf and handed to ALSA by */
+/* dm2_midi_flush() at the end of each processing pass. */
+void dm2_midi_send(struct dm2 *dm2, u8 cmd, u8 param, u8 value)
+{
+	struct usb_dm2 *dev = container_of(dm2, struct usb_dm2, dm2);
+	struct dm2midi *dm2midi = &(dev->dm2midi);
+	u8 status;
+
+	if (!dm2midi->stamped && !dm2midi->hostout) {
+		dm2midi->firststamp = dm2midi->stamp;
+		dm2midi->stamped = 1;
+	}
+
+	status = cmd + dm2midi->chan;
+	trace_dm2_midi_send(status, param, value,
+			    dm2midi->input && (status == dm2midi->out_rstatus));
+	if (dm2midi->seqclient >= 0) dm2_seq_send(dev, cmd, param, value);
+	if (!dm2midi->input) return;
+	if (dm2midi->outlen > DM2_MIDIBUFSIZE - 3) dm2_midi_flush(dev);
+	// Use running status
+	if (status != dm2midi->out_rstatus)
+		dm2midi->outbuf[dm2midi->outlen++] = status;
+	else
+		dev->stats.rstatus_hits++;
+	dm2midi->outbuf[dm2midi->outlen++] = param;
+	dm2midi->outbuf[dm2midi->outlen++] = value;
+	dm2midi->out_rstatus = status;
+}
+
+static void dm2_midi_flush(struct usb_dm2 *dev)
+{
+	struct dm2midi *dm2midi = &(dev->dm2midi);
+	struct snd_rawmidi_substream *input = dm2midi->input;
+	u64 latency;
+	u32 us;
+	int bucket;
+
+	if (dm2midi->outlen && input) {
+		snd_rawmidi_receive(input, dm2midi->outbuf, dm2midi->outlen);
+		dev->stats.midibytes += dm2midi->outlen;
+	}
+	dm2midi->outlen = 0;
+	dm2_ump_flush(dev);
+
+	// Latency from URB completion until the event is delivered
+	if (!dm2midi->stamped) return;
+	dm2midi->stamped = 0;
+	latency = ktime_to_ns(ktime_sub(ktime_get(), dm2midi->firststamp));
+	dev->stats.lat_count++;
+	dev->stats.lat_sum += latency;
+	if (latency > dev->stats.lat_max) dev->stats.lat_max = latency;
+	us = (u32)min_t(u64, div_u64(latency, NSEC_PER_USEC), 0x7fffffff);
+	bucket = fls(us);
+	if (bucket >= DM2_LATBUCKETS) bucket = DM2_LATBUCKETS - 1;
+	dev->stats.lat_hist[bucket]++;
+}
+
+
+static int dm2_midi_init(struct usb_dm2 *dev)
+{
+	struct snd_rawmidi *rmidi;
+	struct snd_card *card;
+	int err, i;
+
+	if (snd_card_create(index, id, THIS_MODULE, 0, &card) < 0) {
+		printk("%s snd_card_create failed\n", __FUNCTION__);
+		return -ENOMEM;
+	}
+	dev->dm2midi.card = card;
+	if ((err = snd_rawmidi_new(dev->dm2midi.card, "Mixman DM2", 1, 1, 1, &rmidi)) < 0) {
+		printk("%s snd_rawmidi_new failed\n", __FUNCTION__);
+		return err;
+	}
+	strcpy(rmidi->name, "Mixman DM2");
+	snd_rawmidi_set_ops(rmidi, SNDRV_RAWMIDI_STREAM_OUTPUT, &dm2_midi_output);
+	snd_rawmidi_set_ops(rmidi, SNDRV_RAWMIDI_STREAM_INPUT, &dm2_midi_input);
+	rmidi->info_flags |= SNDRV_RAWMIDI_INFO_OUTPUT | SNDRV_RAWMIDI_INFO_INPUT | SNDRV_RAWMIDI_INFO_DUPLEX;
+	rmidi->private_data = dev;
+	dev->dm2midi.rmidi = rmidi;
+
+	if (ump && (err = dm2_ump_init(dev)) < 0)
+		err("Could not create UMP endpoint (%d), using rawmidi only.", err);
+
+	if ((err = snd_card_register(dev->dm2midi.card)) < 0) {
+		printk( "%s snd_card_register failed\n", __FUNCTION__);
+		snd_card_free(dev->dm2midi.card);
+		return err;
+	}
+
+	// Variables
+	dev->dm2midi.chan = 0;
+	dev->dm2midi.out_rstatus = 0;
+	for (i=0; i<DM2_NUMHOST; i++)
+		dev->dm2midi.host[i].parser.chan = dev->dm2midi.chan;
+
+	if (seq && (err = dm2_seq_init(dev)) < 0)
+		err("Could not create sequencer client (%d), using rawmidi only.", err);
+
+	return 0;
+}
+
+
+static void dm2_midi_destroy(struct usb_dm2 *dev)
+{
+	dm2_seq_destroy(dev);
+	if (dev->dm2midi.card) {
+                snd_card_free(dev->dm2midi.card);
+		dev->dm2midi.card = NULL;
+	}
+}
+
+
+/* End of MIDI functions */
+
+
+
+/* Generic USB driver section below. Only hook new functions in, do not edit a lot! */
+
+
+static void dm2_count_error(unsigned long *table, int status)
+{
+	int code = -status;
+
+	table[((code > 0) && (code < DM2_NUMERRS)) ? code : 0]++;
+}
+
+
+static void dm2_write_int_callback(struct urb *urb)
+{
+	struct usb_dm2 *dev;
+	unsigned long flags;
+
+	dev = (struct usb_dm2 *)urb->context;
+	if (urb->status) dm2_count_error(dev->stats.out_errors, urb->status);
+
+	/* sync/async unlink faults aren't errors */
+	if (urb->status &&
+	    !(urb->status == -ENOENT ||
+	      urb->status == -ECONNRESET ||
+	      urb->status == -ESHUTDOWN)) {
+		err("%s - nonzero write status received: %d",
+		    __FUNCTION__, urb->status);
+	}
+
+	/* Front buffer is free again, send what came in meanwhile */
+	spin_lock_irqsave(&dev->lock, flags);
+	dev->int_out_busy = 0;
+	if (dev->int_out_pending && urb->status != -ESHUTDOWN)
+		dm2_write(dev);
+	spin_unlock_irqrestore(&dev->lock, flags);
+}
+
+
+/* Submit the back buffer and swap buffers. Call with dev->lock held. */
+static int dm2_write(struct usb_dm2 *dev)
+{
+	int retval = 0;
+	struct urb *urb = NULL;
+
+	/* If there's trouble with output (on <=2.6.22 without patch),
+	 * we bail out immediately. */
+	if (dev->output_failed) goto exit;
+
+	/* this makes sure we don't submit URBs to gone devices */
+	if (!dev->interface) {		/* disconnect() was called */
+		retval = -ENODEV;
+		goto exit;
+	}
+
+	urb = dev->int_out_urbs[dev->int_out_next];
+	trace_dm2_write(urb->transfer_buffer);
+
+	/* send the data out the int port */
+	retval = usb_submit_urb(urb, GFP_ATOMIC);
+	if (retval) {
+		dm2_count_error(dev->stats.out_errors, retval);
+		err("%s - failed submitting write urb, error %d", __FUNCTION__, retval);
+		if (retval == -EINVAL) {
+			dev->output_failed = 1;
+			info("Your kernel cannot transmit data to the DM2.");
+			info("The driver will still work, but there will be no LED output.");
+			info("To make the LEDs work on 2.6.22, please apply the kernel patch that came with this driver!");
+		}
+		goto exit;
+	}
+
+	/* The other buffer collects updates until this one completes */
+	dev->stats.leds_written++;
+	dev->int_out_pending = 0;
+	dev->int_out_busy = 1;
+	dev->int_out_next ^= 1;
+
+	return 0;
+
+exit:
+	if (dev->int_out_pending) dev->stats.leds_failed++;
+	dev->int_out_pending = 0;
+	return retval;
+}
+
+
+/* Compare completion times against the polling interval. Every URB */
+/* from the pool completes once per interval, so a longer gap means  */
+/* that the host skipped a slot. */
+static void dm2_check_timing(struct usb_dm2 *dev, struct urb *urb, ktime_t now)
+{
+	s64 period, delta, us = ktime_to_us(now);
+
+	// urb->interval is in frames, or microframes at high speed.
+	period = urb->interval * ((dev->udev->speed == USB_SPEED_HIGH) ? 125 : 1000);
+	if (dev->int_in_last && period) {
+		delta = us - dev->int_in_last;
+		if (delta > period + period/2) {
+			dev->stats.late++;
+			dev->stats.missed += div_s64(delta + period/2, period) - 1;
+		}
+	}
+	dev->int_in_last = us;
+}
+
+static void dm2_read_int_callback(struct urb *urb)
+{
+	// ATTENTION: Called in interrupt context!
+	struct usb_dm2 *dev = urb->context;
+	ktime_t now = ktime_get();
+
+	trace_dm2_report(urb->transfer_buffer, urb->actual_length, urb->status);
+	if (urb->status == 0) {
+		dm2_check_timing(dev, urb, now);
+		dm2_update_status(dev, urb->transfer_buffer, urb->actual_length, now);
+	} else {
+		dm2_count_error(dev->stats.in_errors, urb->status);
+		dev->int_in_last = 0;
+	}
+	// Resubmitting puts the URB back at the end of the endpoint queue,
+	// so the pool keeps cycling in order.
+	if (urb->status != -ENOENT && urb->status != -ECONNRESET) {
+		urb->dev = dev->udev;
+		usb_submit_urb(urb, GFP_ATOMIC);
+	}
+}
+
+static void dm2_free_writer(struct usb_dm2 *dev) {
+	int i;
+	struct urb *urb;
+
+	for (i=0; i<2; i++) {
+		urb = dev->int_out_urbs[i];
+		if (!urb) continue;
+		kfree(urb->transfer_buffer);
+		usb_free_urb(urb);
+		dev->int_out_urbs[i] = NULL;
+	}
+}
+
+static int dm2_setup_writer(struct usb_dm2 *dev) {
+	int bufsize = DM2_LEDLEN;
+	int i;
+	void *buf = NULL;
+	struct urb *urb = NULL;
+
+	for (i=0; i<2; i++) {
+		buf = kmalloc(bufsize, GFP_KERNEL);
+		if (!buf)
+			goto nomem;
+		memset(buf, 0xff, bufsize);	/* All LEDs off */
+
+		urb = usb_alloc_urb(0, GFP_KERNEL);
+		if (!urb) {
+			kfree(buf);
+			goto nomem;
+		}
+#ifdef USE_BULK_SNDPIPE
+		// Compatibility code for older kernels:
+		usb_fill_bulk_urb(urb, dev->udev,
+				  usb_sndbulkpipe(dev->udev, dev->int_out_endpointAddr),
+				  buf, bufsize, dm2_write_int_callback, dev);
+#else
+		usb_fill_int_urb(urb, dev->udev,
+				 usb_sndintpipe(dev->udev, dev->int_out_endpointAddr),
+				 buf, bufsize, dm2_write_int_callback, dev, 10);
+#endif
+		// urb->transfer_flags |= URB_NO_TRANSFER_DMA_MAP || URB_ZERO_PACKET;
+
+		dev->int_out_urbs[i] = urb;
+	}
+
+	return 0;
+
+nomem:
+	dm2_free_writer(dev);
+	return -ENOMEM;
+}
+
+static void dm2_free_reader(struct usb_dm2 *dev) {
+	int i;
+	struct urb *urb;
+
+	for (i=0; i<dev->int_in_count; i++) {
+		urb = dev->int_in_urbs[i];
+		kfree(urb->transfer_buffer);
+		usb_free_urb(urb);
+		dev->int_in_urbs[i] = NULL;
+	}
+	dev->int_in_count = 0;
+}
+
+static void dm2_kill_reader(struct usb_dm2 *dev) {
+	int i;
+
+	for (i=0; i<dev->int_in_count; i++)
+		usb_kill_urb(dev->int_in_urbs[i]);
+}
+
+static int dm2_setup_reader(struct usb_dm2 *dev) {
+	int bufsize = 32;
+	int i, count, retval;
+	void *buf = NULL;
+	struct urb *urb = NULL;
+
+	count = inurbs;
+	if (count < 1) count = 1;
+	if (count > DM2_MAXINURBS) count = DM2_MAXINURBS;
+
+	for (i=0; i<count; i++) {
+		buf = kmalloc(bufsize, GFP_KERNEL);
+		if (!buf)
+			goto nomem;
+
+		urb = usb_alloc_urb(0, GFP_KERNEL);
+		if (!urb) {
+			kfree(buf);
+			goto nomem;
+		}
+		usb_fill_int_urb(urb, dev->udev,
+				 usb_rcvintpipe(dev->udev, dev->int_in_endpointAddr ),
+				 buf, bufsize,
+				 dm2_read_int_callback, dev, dev->int_in_interval);
+		dev->int_in_urbs[dev->int_in_count++] = urb;
+	}
+
+	// Submit all at once, so that the host always has one queued.
+	for (i=0; i<dev->int_in_count; i++) {
+		retval = usb_submit_urb(dev->int_in_urbs[i], GFP_KERNEL);
+		if (retval) {
+			dm2_kill_reader(dev);
+			dm2_free_reader(dev);
+			return retval;
+		}
+	}
+	return 0;
+
+nomem:
+	dm2_free_reader(dev);
+	return -ENOMEM;
+}
+
+/* Diagnostics in debugfs: dm2/<usb interface>/{stats,latency,calibration}. */
+/* Writing anything to stats or latency clears the counters it shows. */
+
+static void dm2_debugfs_errors(struct seq_file *m, const char *name,
+			       const unsigned long *table)
+{
+	int i;
+
+	seq_printf(m, "%s:", name);
+	for (i=1; i<DM2_NUMERRS; i++)
+		if (table[i]) seq_printf(m, " %d:%lu", -i, table[i]);
+	if (table[0]) seq_printf(m, " other:%lu", table[0]);
+	seq_puts(m, "\n");
+}
+
+static int dm2_debugfs_stats_show(struct seq_file *m, void *v)
+{
+	struct usb_dm2 *dev = m->private;
+	struct dm2stats *stats = &(dev->stats);
+
+	seq_printf(m, "reports: %lu\n", stats->reports);
+	seq_printf(m, "bad length: %lu\n", stats->badlength);
+	seq_printf(m, "ring overruns: %lu\n", stats->overruns);
+	seq_printf(m, "late completions: %lu\n", stats->late);
+	seq_printf(m, "missed intervals: %lu\n", stats->missed);
+	dm2_debugfs_errors(m, "input urb errors", stats->in_errors);
+	dm2_debugfs_errors(m, "output urb errors", stats->out_errors);
+	seq_printf(m, "context: %s\n", dm2_ctxnames[dev->context]);
+	seq_printf(m, "passes: %lu\n", stats->passes);
+	seq_printf(m, "midi bytes: %lu\n", stats->midibytes);
+	seq_printf(m, "running status hits: %lu\n", stats->rstatus_hits);
+	if (dev->dm2midi.ump) seq_printf(m, "ump bytes: %lu\n", stats->umpbytes);
+	seq_printf(m, "led writes: %lu\n", stats->leds_written);
+	seq_printf(m, "led updates merged: %lu\n", stats->leds_merged);
+	seq_printf(m, "led updates failed: %lu\n", stats->leds_failed);
+	if (dev->preset == DM2_SYSEXPRESET)
+		seq_puts(m, "preset: from SysEx\n");
+	else
+		seq_printf(m, "preset: %d\n", dev->preset);
+	seq_printf(m, "host bytes: %lu in %lu pieces, %lu dropped\n",
+		   stats->hostbytes, stats->hostdrains, stats->hostdropped);
+	seq_printf(m, "sysex messages: %lu, %lu bad\n", stats->sysex,
+		   stats->sysex_bad + dev->dm2.counters.badsysex);
+	seq_printf(m, "preset switches: %lu\n", stats->preset_switches);
+	if (stats->preset_switches)
+		seq_printf(m, "preset switch us: last %llu max %llu\n",
+			   div_u64(stats->preset_lat_last, NSEC_PER_USEC),
+			   div_u64(stats->preset_lat_max, NSEC_PER_USEC));
+	seq_printf(m, "reports late for preset switch: %lu\n", stats->preset_late);
+	seq_printf(m, "slider moves suppressed: %lu\n", dev->dm2.counters.suppressed);
+	seq_printf(m, "slider moves merged: %lu\n", dev->dm2.counters.merged);
+	return 0;
+}
+
+static int dm2_debugfs_latency_show(struct seq_file *m, void *v)
+{
+	struct usb_dm2 *dev = m->private;
+	struct dm2stats *stats = &(dev->stats);
+	int i;
+
+	seq_printf(m, "context: %s\n", dm2_ctxnames[dev->context]);
+	seq_printf(m, "count: %lu\n", stats->lat_count);
+	if (stats->lat_count)
+		seq_printf(m, "avg us: %llu\nmax us: %llu\n",
+			   div64_ul(stats->lat_sum, stats->lat_count) / NSEC_PER_USEC,
+			   div_u64(stats->lat_max, NSEC_PER_USEC));
+	for (i=0; i<DM2_LATBUCKETS; i++)
+		if (stats->lat_hist[i])
+			seq_printf(m, "< %8u us: %lu\n", 1u << i, stats->lat_hist[i]);
+	return 0;
+}
+
+/* Slider calibration and the table it gives, raw position to value */
+static int dm2_debugfs_calibration_show(struct seq_file *m, void *v)
+{
+	static const char *names[3] = { "x", "y", "fader" };
+	struct usb_dm2 *dev = m->private;
+	struct dm2slider *slider;
+	int i, raw;
+
+	if (dev->dm2.initialize) {
+		seq_puts(m, "calibrating\n");
+		return 0;
+	}
+	for (i=0; i<3; i++) {
+		slider = &(dev->dm2.sliders[i]);
+		seq_printf(m, "%s: param %u bits %d pos %u min %u mid %u dead %u max ",
+			   names[i], slider->param, slider->hires ? 14 : 7, slider->pos,
+			   slider->min, slider->mid, slider->dead);
+		if (slider->max) seq_printf(m, "%u\n", slider->max);
+		else seq_puts(m, "mirrored\n");
+		for (raw=0; raw<256; raw++)
+			seq_printf(m, ((raw & 15) == 15) ? "%6u\n" : "%6u", slider->lut[raw]);
+	}
+	return 0;
+}
+
+static void dm2_stats_clear(struct dm2stats *stats)
+{
+	memset(stats, 0, offsetof(struct dm2stats, lat_count));
+}
+
+static void dm2_latency_clear(struct dm2stats *stats)
+{
+	stats->lat_count = 0;
+	stats->lat_sum = stats->lat_max = 0;
+	memset(stats->lat_hist, 0, sizeof(stats->lat_hist));
+}
+
+static int dm2_debugfs_stats_open(struct inode *inode, struct file *file)
+{
+	return single_open(file, dm2_debugfs_stats_show, inode->i_private);
+}
+
+static int dm2_debugfs_latency_open(struct inode *inode, struct file *file)
+{
+	return single_open(file, dm2_debugfs_latency_show, inode->i_private);
+}
+
+static int dm2_debugfs_calibration_open(struct inode *inode, struct file *file)
+{
+	return single_open(file, dm2_debugfs_calibration_show, inode->i_private);
+}
+
+static ssize_t dm2_debugfs_stats_write(struct file *file, const char __user *buf,
+				       size_t count, loff_t *ppos)
+{
+	struct usb_dm2 *dev = ((struct seq_file *)file->private_data)->private;
+
+	dm2_stats_clear(&(dev->stats));
+	memset(&(dev->dm2.counters), 0, sizeof(dev->dm2.counters));
+	return count;
+}
+
+static ssize_t dm2_debugfs_latency_write(struct file *file, const char __user *buf,
+					 size_t count, loff_t *ppos)
+{
+	struct usb_dm2 *dev = ((struct seq_file *)file->private_data)->private;
+
+	dm2_latency_clear(&(dev->stats));
+	return count;
+}
+
+static const struct file_operations dm2_debugfs_stats_fops = {
+	.owner =	THIS_MODULE,
+	.open =		dm2_debugfs_stats_open,
+	.read =		seq_read,
+	.write =	dm2_debugfs_stats_write,
+	.llseek =	seq_lseek,
+	.release =	single_release,
+};
+
+static const struct file_operations dm2_debugfs_latency_fops = {
+	.owner =	THIS_MODULE,
+	.open =		dm2_debugfs_latency_open,
+	.read =		seq_read,
+	.write =	dm2_debugfs_latency_write,
+	.llseek =	seq_lseek,
+	.release =	single_release,
+};
+
+static const struct file_operations dm2_debugfs_calibration_fops = {
+	.owner =	THIS_MODULE,
+	.open =		dm2_debugfs_calibration_open,
+	.read =		seq_read,
+	.llseek =	seq_lseek,
+	.release =	single_release,
+};
+
+static void dm2_debugfs_init(struct usb_dm2 *dev)
+{
+	if (!dm2_debugfs_root) return;
+	dev->debugfs = debugfs_create_dir(dev_name(&dev->interface->dev), dm2_debugfs_root);
+	if (IS_ERR_OR_NULL(dev->debugfs)) {
+		dev->debugfs = NULL;
+		return;
+	}
+	debugfs_create_file("stats", 0600, dev->debugfs, dev, &dm2_debugfs_stats_fops);
+	debugfs_create_file("latency", 0600, dev->debugfs, dev, &dm2_debugfs_latency_fops);
+	debugfs_create_file("calibration", 0400, dev->debugfs, dev, &dm2_debugfs_calibration_fops);
+}
+
+static void dm2_debugfs_destroy(struct usb_dm2 *dev)
+{
+	debugfs_remove_recursive(dev->debugfs);
+	dev->debugfs = NULL;
+}
+
+/* Slider calibration in sysfs, as the nine numbers of the calibration */
+/* module parameter. Reading it fails until the sliders are calibrated; */
+/* writing restores it at once and again after every reset. */
+
+static void dm2_calibration_apply(struct usb_dm2 *dev)
+{
+	if (dev->calibrated) dm2_calibration_restore(&(dev->dm2), dev->calib);
+}
+
+static void dm2_calibration_param(struct usb_dm2 *dev)
+{
+	unsigned long flags;
+	int i, retval;
+
+	if (!ncalibration) return;
+	for (i=0; i<9; i++)
+		if ((ncalibration != 9) || (calibration[i] < 0) || (calibration[i] > 255)) {
+			err("calibration needs 9 values from 0 to 255, ignored");
+			return;
+		}
+	for (i=0; i<3; i++) {
+		dev->calib[i].min = calibration[3*i];
+		dev->calib[i].mid = calibration[3*i+1];
+		dev->calib[i].max = calibration[3*i+2];
+	}
+	dm2_proc_lock(dev, &flags);
+	retval = dm2_calibration_restore(&(dev->dm2), dev->calib);
+	if (!retval) dev->calibrated = 1;
+	dm2_proc_unlock(dev, flags);
+	if (retval) err("calibration does not fit the dead zone, ignored");
+}
+
+static ssize_t dm2_calibration_show(struct device *d, struct device_attribute *attr,
+				    char *buf)
+{
+	struct usb_dm2 *dev = usb_get_intfdata(to_usb_interface(d));
+	struct dm2_calibration calib[3];
+	unsigned long flags;
+
+	if (!dev) return -ENODEV;
+	if (dev->dm2.initialize) return -EAGAIN;
+	dm2_proc_lock(dev, &flags);
+	dm2_calibration_get(&(dev->dm2), calib);
+	dm2_proc_unlock(dev, flags);
+	return sprintf(buf, "%u %u %u %u %u %u %u %u %u\n",
+		       calib[0].min, calib[0].mid, calib[0].max,
+		       calib[1].min, calib[1].mid, calib[1].max,
+		       calib[2].min, calib[2].mid, calib[2].max);
+}
+
+static ssize_t dm2_calibration_store(struct device *d, struct device_attribute *attr,
+				     const char *buf, size_t count)
+{
+	struct usb_dm2 *dev = usb_get_intfdata(to_usb_interface(d));
+	struct dm2_calibration calib[3];
+	unsigned int v[9];
+	unsigned long flags;
+	int i, retval;
+
+	if (!dev) return -ENODEV;
+	if (sscanf(buf, "%u %u %u %u %u %u %u %u %u",
+		   &v[0], &v[1], &v[2], &v[3], &v[4], &v[5], &v[6], &v[7], &v[8]) != 9)
+		return -EINVAL;
+	for (i=0; i<9; i++)
+		if (v[i] > 255) return -EINVAL;
+	for (i=0; i<3; i++) {
+		calib[i].min = v[3*i];
+		calib[i].mid = v[3*i+1];
+		calib[i].max = v[3*i+2];
+	}
+
+	dm2_proc_lock(dev, &flags);
+	retval = dm2_calibration_restore(&(dev->dm2), calib);
+	if (!retval) {
+		memcpy(dev->calib, calib, sizeof(calib));
+		dev->calibrated = 1;
+	}
+	dm2_proc_unlock(dev, flags);
+	return retval ? -EINVAL : count;
+}
+
+static DEVICE_ATTR(calibration, 0644, dm2_calibration_show, dm2_calibration_store);
+
+/* Presets from a file in the firmware search path: dm2-presets.bin if */
+/* there is one at probe, and any file named in the presets attribute */
+/* later. The table is replaced under proclock, and the next pass loads */
+/* the preset in use again from the new table. */
+
+#define DM2_PRESETFW "dm2-presets.bin"
+
+static int dm2_presets_install(struct usb_dm2 *dev, const struct firmware *fw,
+			       const char *name)
+{
+	const struct dm2_params *old;
+	struct dm2_params *presets;
+	unsigned long flags;
+	int n;
+
+	n = dm2_presets_parse(fw->data, fw->size, NULL);
+	if (n < 0) {
+		err("%s is not a valid DM2 preset file (version %d) or has a preset "
+		    "the driver cannot send", name, DM2_PRESETVERSION);
+		return -EINVAL;
+	}
+	presets = kmalloc_array(n, sizeof(*presets), GFP_KERNEL);
+	if (!presets) return -ENOMEM;
+	dm2_presets_parse(fw->data, fw->size, presets);
+
+	dm2_proc_lock(dev, &flags);
+	old = dev->presets;
+	dev->presets = presets;
+	WRITE_ONCE(dev->npresets, n);
+	snprintf(dev->presetfile, sizeof(dev->presetfile), "%s", name);
+	dev->presetstamp = ktime_get();
+	smp_wmb();
+	atomic_set(&dev->presetreq, ((dev->preset < n) ? dev->preset : 0) + 1);
+	dm2_proc_unlock(dev, flags);
+
+	if (old != dm2_params) kfree(old);
+	dm2_schedule(dev);
+	info("%d presets loaded from %s", n, name);
+	return 0;
+}
+
+static void dm2_presets_loaded(const struct firmware *fw, void *context)
+{
+	struct usb_dm2 *dev = context;
+
+	if (fw) dm2_presets_install(dev, fw, DM2_PRESETFW);
+	release_firmware(fw);
+	kref_put(&dev->kref, dm2_delete);
+}
+
+/* The file is optional, so its absence is not worth a warning */
+static void dm2_presets_request(struct usb_dm2 *dev)
+{
+	kref_get(&dev->kref);
+	if (firmware_request_nowait_nowarn(THIS_MODULE, DM2_PRESETFW, &dev->udev->dev,
+					   GFP_KERNEL, dev, dm2_presets_loaded))
+		kref_put(&dev->kref, dm2_delete);
+}
+
+static ssize_t dm2_presets_show(struct device *d, struct device_attribute *attr,
+				char *buf)
+{
+	struct usb_dm2 *dev = usb_get_intfdata(to_usb_interface(d));
+
+	if (!dev) return -ENODEV;
+	return sprintf(buf, "%d %s\n", READ_ONCE(dev->npresets),
+		       dev->presetfile[0] ? dev->presetfile : "built-in");
+}
+
+static ssize_t dm2_presets_store(struct device *d, struct device_attribute *attr,
+				 const char *buf, size_t count)
+{
+	struct usb_dm2 *dev = usb_get_intfdata(to_usb_interface(d));
+	const struct firmware *fw;
+	char name[64];
+	int retval;
+
+	if (!dev) return -ENODEV;
+	if (sscanf(buf, "%63s", name) != 1) return -EINVAL;
+	retval = request_firmware(&fw, name, &dev->udev->dev);
+	if (retval) return retval;
+	retval = dm2_presets_install(dev, fw, name);
+	release_firmware(fw);
+	return retval ? retval : count;
+}
+
+static DEVICE_ATTR(presets, 0644, dm2_presets_show, dm2_presets_store);
+
+static void dm2_delete(struct kref *kref)
+{
+	struct usb_dm2 *dev = to_dm2_dev(kref);
+	// struct urb *urb;
+
+	dm2_ledclock_stop(dev);
+	dm2_context_stop(dev);
+
+	usb_put_dev(dev->udev);
+	if (dev->presets != dm2_params) kfree(dev->presets);
+	kfree(dev->int_in_buffer);
+	dm2_free_reader(dev);
+	dm2_free_writer(dev);
+
+	kfree(dev);
+}
+
+static int dm2_probe(struct usb_interface *interface, const struct usb_device_id *id)
+{
+	struct usb_dm2 *dev;
+	struct usb_host_interface *iface_desc;
+	struct usb_endpoint_descriptor *endpoint;
+	size_t buffer_size;
+	int i;
+	int retval = -ENOMEM;
+
+	/* allocate memory for our device state and initialize it */
+	dev = kzalloc(sizeof(*dev), GFP_KERNEL);
+	if (!dev) {
+		err("Out of memory");
+		goto error;
+	}
+	kref_init(&dev->kref);
+	// 0 is the system client, no client until dm2_seq_init()
+	dev->dm2midi.seqclient = -1;
+	dev->presets = dm2_params;
+	dev->npresets = DM2_NUMPRESETS;
+	spin_lock_init(&dev->dm2midi.hostlock);
+	dm2_ledclock_init(dev);
+	retval = dm2_context_init(dev);
+	if (retval) {
+		err("Could not start the processing thread.");
+		goto error;
+	}
+	retval = -ENOMEM;
+	dev->lock = __SPIN_LOCK_UNLOCKED();
+
+	dev->udev = usb_get_dev(interface_to_usbdev(interface));
+	dev->interface = interface;
+
+	/* set up the endpoint information */
+	/* use only the first int-in and int-out endpoints */
+	iface_desc = interface->cur_altsetting;
+	for (i = 0; i < iface_desc->desc.bNumEndpoints; ++i) {
+		endpoint = &iface_desc->endpoint[i].desc;
+		if (!dev->int_in_endpointAddr &&
+		    usb_endpoint_is_int_in(endpoint)) {
+			/* we found a int in endpoint */
+			buffer_size = le16_to_cpu(endpoint->wMaxPacketSize);
+			dev->int_in_size = buffer_size;
+			dev->int_in_endpointAddr = endpoint->bEndpointAddress;
+			dev->int_in_interval = endpoint->bInterval;
+			dev->int_in_buffer = kmalloc(buffer_size, GFP_KERNEL);
+			if (!dev->int_in_buffer) {
+				err("Could not allocate int_in_buffer");
+				goto error;
+			}
+		}
+#ifdef USE_BULK_SNDPIPE
+		// Compatibility code for older kernels:
+		if (!dev->int_out_endpointAddr &&
+		    usb_endpoint_is_bulk_out(endpoint)) {
+			/* we found a bulk out endpoint */
+			dev->int_out_endpointAddr = endpoint->bEndpointAddress;
+		}
+#else
+		if (!dev->int_out_endpointAddr &&
+		    usb_endpoint_is_int_out(endpoint)) {
+			/* we found an int out endpoint */
+			dev->int_out_endpointAddr = endpoint->bEndpointAddress;
+		}
+#endif
+	}
+	if (!(dev->int_in_endpointAddr && dev->int_out_endpointAddr)) {
+		err("Could not find both int-in and int-out endpoints");
+		goto error;
+	}
+
+	/* save our data pointer in this interface device */
+	usb_set_intfdata(interface, dev);
+
+	retval = dm2_setup_writer(dev);
+	if (retval) {
+		err("Problem setting up the writer.");
+		usb_set_intfdata(interface, NULL);
+		goto error;
+	}
+
+	/* the state and MIDI must be ready before the first report */
+	dm2_internal_init(&(dev->dm2), &(dm2_params[0]));
+	retval = dm2_midi_init(dev);
+	if (retval) {
+		err("Problem setting up MIDI.");
+		usb_set_intfdata(interface, NULL);
+		goto error;
+	}
+
+	retval = dm2_setup_reader(dev);
+	if (retval) {
+		err("Problem setting up the reader.");
+		usb_set_intfdata(interface, NULL);
+		goto error;
+	}
+
+	dm2_calibration_param(dev);
+	dm2_debugfs_init(dev);
+	if (device_create_file(&interface->dev, &dev_attr_calibration) ||
+	    device_create_file(&interface->dev, &dev_attr_presets))
+		err("Could not create the sysfs attributes.");
+	dm2_presets_request(dev);
+
+
+	info("Mixman DM2 device now attached.");
+	return 0;
+
+error:
+	if (dev) {
+		dm2_midi_destroy(dev);
+		/* this frees allocated memory */
+		kref_put(&dev->kref, dm2_delete);
+	}
+	return retval;
+}
+
+static void dm2_disconnect(struct usb_interface *interface)
+{
+	struct usb_dm2 *dev;
+	unsigned long flags;
+
+	dev = usb_get_intfdata(interface);
+	device_remove_file(&interface->dev, &dev_attr_calibration);
+	device_remove_file(&interface->dev, &dev_attr_presets);
+
+	/* prevent dm2_open() from racing dm2_disconnect() */
+	spin_lock_irqsave(&dev->lock, flags);
+
+	usb_set_intfdata(interface, NULL);
+	/* prevent more I/O from starting */
+	dev->interface = NULL;
+
+	spin_unlock_irqrestore(&dev->lock, flags);
+
+	dm2_debugfs_destroy(dev);
+
+	/* stop the input URB pool and pending LED output */
+	dm2_kill_reader(dev);
+	usb_kill_urb(dev->int_out_urbs[0]);
+	usb_kill_urb(dev->int_out_urbs[1]);
+	dm2_ledclock_stop(dev);
+	dm2_context_stop(dev);
+
+	if (dev->stats.overruns)
+		info("%lu reports were lost to input ring overruns", dev->stats.overruns);
+	if (dev->stats.late)
+		info("%lu late input completions, %lu polling intervals missed",
+		     dev->stats.late, dev->stats.missed);
+	info("%lu LED writes, %lu LED updates merged",
+	     dev->stats.leds_written, dev->stats.leds_merged);
+	if (dev->stats.lat_count)
+		info("%s context: completion-to-MIDI latency avg %llu us, max %llu us",
+		     dm2_ctxnames[dev->context],
+		     div64_ul(dev->stats.lat_sum, dev->stats.lat_count) / NSEC_PER_USEC,
+		     div_u64(dev->stats.lat_max, NSEC_PER_USEC));
+
+	/* the seq client and the card use dev until they are gone */
+	dm2_midi_destroy(dev);
+
+	/* decrement our usage count */
+	kref_put(&dev->kref, dm2_delete);
+
+	info("Mixman DM2 now disconnected");
+}
+
+static struct usb_driver dm2_driver = {
+	.name =		"Mixman DM2",
+	.probe =	dm2_probe,
+	.disconnect =	dm2_disconnect,
+	.id_table =	dm2_table,
+	.supports_autosuspend = 0,
+};
+
+static int __init usb_dm2_init(void)
+{
+	int result;
+
+	dm2_debugfs_root = debugfs_create_dir("dm2", NULL);
+	if (IS_ERR(dm2_debugfs_root)) dm2_debugfs_root = NULL;
+
+	/* register this driver with the USB subsystem */
+	result = usb_register(&dm2_driver);
+	if (result) {
+		err("usb_register failed. Error number %d", result);
+		debugfs_remove_recursive(dm2_debugfs_root);
+	}
+
+	return result;
+}
+
+static void __exit usb_dm2_exit(void)
+{
+	/* deregister this driver with the USB subsystem */
+	usb_deregister(&dm2_driver);
+	debugfs_remove_recursive(dm2_debugfs_root);
+}
+
+module_init(usb_dm2_init);
+module_exit(usb_dm2_exit);
+
+MODULE_LICENSE("GPL");
@@ -0,0 +1,393 @@
+/*
+ * dm2bench.c  -  Replay DM2 reports through the driver core in userspace
+ *
+ *
+ * Copyright (C) 2007-2008 Jan Jockusch (jan@jockusch.de)
+ *
+ *	This program is free software; you can redistribute it and/or
+ *	modify it under the terms of the GNU General Public License as
+ *	published by the Free Software Foundation, version 2.
+ *
+ */
+
+/* Runs a stream of 10 byte DM2 reports through dm2core.c for every
+ * preset and prints the cost per report and the MIDI traffic it
+ * caused. Reports are read from any file dm2capture.c understands
+ * (usbmon text, pcap, hex text or raw records). Without a file a
+ * synthetic stream is generated.
+ *
+ * Without a file, or with -s, the state machines are also timed one
+ * by one: each wheel key mode of the table in dm2core.h, jog (also with
+ * the example acceleration curve and platter position), sliders (also
+ * a noisy fader with and without the jitter filters),
+ * buttons and LED feedback, each with a stream that only exercises
+ * that part. Last, a burst of LED feedback from the host goes through
+ * the MIDI parser in pieces of several sizes, for its bytes per second.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <time.h>
+
+#include "dm2core.h"
+#include "dm2capture.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#define cycles()	__rdtsc()
+#else
+#define cycles()	0ULL		/* no cycle counter, only ns */
+#endif
+
+#define SYNTH_REPORTS	4096
+#define SCEN_REPORTS	1024
+#define FEEDBACK_BYTES	4096
+
+static u8 *reports;		/* as handed to the core, byte 5 inverted */
+static int numreports;
+
+static unsigned long midibytes, midimsgs, ledwrites, hostcmds;
+static u8 rstatus;
+
+
+/* Output hooks of the core */
+
+void dm2_midi_send(struct dm2 *dm2, u8 cmd, u8 param, u8 value)
+{
+	midimsgs++;
+	midibytes += (cmd == rstatus) ? 2 : 3;
+	rstatus = cmd;
+}
+
+void dm2_ump_send(struct dm2 *dm2, u8 cmd, u8 index, u32 value)
+{
+}
+
+void dm2_set_leds(struct dm2 *dm2, u8 left, u8 right)
+{
+	ledwrites++;
+}
+
+void dm2_midi_command(struct dm2 *dm2, u8 status, const u8 *data, int len)
+{
+	hostcmds++;
+}
+
+
+/* Somebody playing: wheels spinning with keys held now and then, */
+/* sliders sweeping, buttons pressed. Deterministic. */
+static int synth_reports(struct dm2capture *cap)
+{
+	u8 data[DM2_REPORTLEN];
+	unsigned int seed = 1;
+	int i;
+
+	cap->count = SYNTH_REPORTS;
+	cap->data = malloc(SYNTH_REPORTS * DM2_REPORTLEN);
+	if (!cap->data) return -ENOMEM;
+	for (i = 0; i < SYNTH_REPORTS; i++) {
+		seed = seed * 1103515245 + 12345;
+		memset(data, 0, sizeof(data));
+		if ((i & 511) > 384) data[0] = 1 << ((i >> 9) & 7);
+		if ((i & 255) > 200) data[1] = 1 << ((i >> 8) & 7);
+		if ((i & 63) < 4) data[2] = 1 << ((seed >> 16) & 7);
+		if ((i & 127) < 8) data[3] = 1 << ((seed >> 20) & 7);
+		data[5] = ~(0x20 + ((i * 3) & 0x7f));
+		data[6] = 0x20 + ((i * 5) & 0x7f);
+		data[7] = 0x20 + ((i >> 1) & 0x7f);
+		data[8] = (u8)((int)((seed >> 8) & 15) - 8);
+		data[9] = (i & 1) ? 0 : (u8)((int)((seed >> 12) & 7) - 3);
+		memcpy(cap->data + i * DM2_REPORTLEN, data, DM2_REPORTLEN);
+	}
+	return 0;
+}
+
+
+/* Scenarios for single state machines */
+
+struct scenario {
+	const char	*name;
+	u8		notoggle, note, param;	/* wheel key mode, see dm2core.h */
+	u8		hires;
+	int		curve;			/* jog curve and platter position */
+	u8		hyst, filter, interval;	/* slider jitter filter */
+	void		(*report)(u8 *data, int i);
+	int		feedback;		/* LED note on/off every report */
+};
+
+/* Hold NW of the left wheel and turn, release; again without turning */
+static void scen_wheelkey(u8 *data, int i)
+{
+	if ((i & 63) < 16) data[1] = 0x01;
+	if (((i & 63) >= 4) && ((i & 63) < 12)) data[8] = (i & 64) ? 0x02 : 0xfe;
+	if (((i & 63) >= 32) && ((i & 63) < 48)) data[1] = 0x01;
+}
+
+static void scen_jog(u8 *data, int i)
+{
+	data[8] = (i & 1) ? 0x03 : 0xfd;
+	data[9] = (i & 2) ? 0x01 : 0xff;
+}
+
+/* Slow and fast turns, for the jog curve */
+static void scen_jogspeed(u8 *data, int i)
+{
+	int speed = 1 << ((i >> 4) & 7);
+
+	data[8] = (u8)((i & 512) ? -speed : speed - 1);
+	data[9] = (u8)((i & 512) ? speed - 1 : -speed);
+}
+
+static void scen_sliders(u8 *data, int i)
+{
+	data[5] = ~(0x10 + (i & 0xdf));
+	data[6] = 0x10 + ((i * 3) & 0xdf);
+	data[7] = 0x10 + ((i * 7) & 0xdf);
+}
+
+/* Fader sitting on a boundary, with a slow move now and then */
+static void scen_noise(u8 *data, int i)
+{
+	if (i) data[7] = 0x60 - ((i >> 5) & 31) + ((i * 7 >> 2) & 1);
+}
+
+static void scen_buttons(u8 *data, int i)
+{
+	data[2] = 1 << (i & 7);
+	data[3] = (i & 8) ? 0x01 : 0x00;
+}
+
+static void scen_idle(u8 *data, int i)
+{
+}
+
+static const struct scenario scenarios[] = {
+	{ "key note",             0, 16,  0, 0x00, 0, 1, 0,  0, scen_wheelkey,  0 },
+	{ "key param",            0,  0, 16, 0x00, 0, 1, 0,  0, scen_wheelkey,  0 },
+	{ "key param notoggle",   1,  0, 16, 0x00, 0, 1, 0,  0, scen_wheelkey,  0 },
+	{ "key note+param",       0, 16, 16, 0x00, 0, 1, 0,  0, scen_wheelkey,  0 },
+	{ "key note+param notog", 1, 16, 16, 0x00, 0, 1, 0,  0, scen_wheelkey,  0 },
+	{ "key param 14 bit",     0,  0, 16, 0x18, 0, 1, 0,  0, scen_wheelkey,  0 },
+	{ "jog",                  0,  0,  0, 0x00, 0, 1, 0,  0, scen_jog,       0 },
+	{ "jog speeds",           0,  0,  0, 0x00, 0, 1, 0,  0, scen_jogspeed,  0 },
+	{ "jog curve+position",   0,  0,  0, 0x00, 1, 1, 0,  0, scen_jogspeed,  0 },
+	{ "sliders",              0,  0,  0, 0x00, 0, 1, 0,  0, scen_sliders,   0 },
+	{ "slider noise raw",     0,  0,  0, 0x00, 0, 0, 0,  0, scen_noise,     0 },
+	{ "slider noise hyst",    0,  0,  0, 0x00, 0, 1, 0,  0, scen_noise,     0 },
+	{ "slider noise filter",  0,  0,  0, 0x00, 0, 0, 2, 30, scen_noise,     0 },
+	{ "sliders 14 bit",       0,  0,  0, 0x07, 0, 1, 0,  0, scen_sliders,   0 },
+	{ "buttons",              0,  0,  0, 0x00, 0, 1, 0,  0, scen_buttons,   0 },
+	{ "led feedback",         0,  0,  0, 0x00, 0, 1, 0,  0, scen_idle,      1 },
+};
+
+
+/* Benchmark */
+
+static double now_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+static void bench(const char *name, const struct dm2_params *params, const u8 *reps,
+		  int n, int loops, int interval, int feedback)
+{
+	static struct dm2 dm2;
+	unsigned long total = (unsigned long)loops * n;
+	u32 now = 0;
+	unsigned long long startcycles, elapsedcycles;
+	double start, elapsed;
+	int i, l;
+
+	dm2_internal_init(&dm2, params);
+	// Calibrate on the first report, like on plugging the device in.
+	while (dm2.initialize) dm2_report(&dm2, reps, now);
+
+	midibytes = midimsgs = ledwrites = 0;
+	rstatus = 0;
+	start = now_ns();
+	startcycles = cycles();
+	for (l = 0; l < loops; l++) {
+		for (i = 0; i < n; i++) {
+			if (feedback) dm2_leds_update(&dm2, 64 + (i & 7), (i & 8) ? 0 : 0x7f);
+			now += interval;
+			dm2_report(&dm2, reps + i * DM2_REPORTLEN, now);
+			dm2_leds_frame(&dm2, interval);
+			dm2_tick(&dm2, now);
+		}
+	}
+	elapsedcycles = cycles() - startcycles;
+	elapsed = now_ns() - start;
+
+	printf("%-20s %10lu %10.1f %10.1f %10.3f %10.3f %10.3f\n", name, total,
+	       (double)elapsedcycles / total, elapsed / total, (double)midibytes / total,
+	       (double)midimsgs / total, (double)ledwrites / total);
+}
+
+static void bench_scenarios(int loops, int interval)
+{
+	static u8 reps[SCEN_REPORTS * DM2_REPORTLEN];
+	struct dm2_params params;
+	const struct scenario *sc;
+	u8 *data;
+	int i, n;
+
+	for (n = 0; n < (int)(sizeof(scenarios)/sizeof(scenarios[0])); n++) {
+		sc = &scenarios[n];
+		params = dm2_params[0];
+		params.wheel0notes[0] = sc->note;
+		params.wheel0params[0] = sc->param;
+		params.notoggle0 = sc->notoggle;
+		params.relparams0 = 0;
+		params.hires = sc->hires;
+		memset(params.sliderhyst, sc->hyst, 3);
+		memset(params.sliderfilter, sc->filter, 3);
+		memset(params.sliderinterval, sc->interval, 3);
+		if (sc->curve) {
+			static const u8 curve[8] = { 1, 2, 3, 6, 14, 32, 80, 127 };
+			memcpy(params.jogcurve, curve, sizeof(curve));
+			params.jogpos0 = 8;
+			params.jogpos1 = 9;
+		}
+		for (i = 0; i < SCEN_REPORTS; i++) {
+			data = reps + i * DM2_REPORTLEN;
+			memset(data, 0, DM2_REPORTLEN);
+			data[5] = 0x80; data[6] = data[7] = 0x80;
+			sc->report(data, i);
+		}
+		bench(sc->name, &params, reps, SCEN_REPORTS, loops, interval, sc->feedback);
+	}
+}
+
+/* What Mixxx sends when a deck starts: LED notes on and off in */
+/* running status, CCs, a program change now and then, and clock */
+static int synth_feedback(u8 *buf)
+{
+	int n = 0, i = 0;
+
+	while (n < FEEDBACK_BYTES - 8) {
+		if (!(i & 15)) buf[n++] = 0x90;
+		buf[n++] = ((i & 8) ? 80 : 64) + (i & 7);
+		buf[n++] = (i & 16) ? 0 : 0x7f;
+		if (!(i & 31)) {
+			buf[n++] = 0xb0;
+			buf[n++] = 64 + (i & 7);
+			buf[n++] = i & 0x7f;
+		}
+		if (!(i & 255)) {
+			buf[n++] = 0xc0;
+			buf[n++] = 0;
+		}
+		if (!(i & 3)) buf[n++] = 0xf8;
+		i++;
+	}
+	return n;
+}
+
+/* The host's bytes in pieces of chunk, one processing pass per piece */
+static void bench_feedback(int loops, int chunk)
+{
+	static u8 buf[FEEDBACK_BYTES];
+	static struct dm2 dm2;
+	static struct dm2parser parser;
+	u8 idle[DM2_REPORTLEN] = { [5] = 0x80, [6] = 0x80, [7] = 0x80 };
+	int len = synth_feedback(buf), l, i;
+	unsigned long total = (unsigned long)loops * len;
+	unsigned long long startcycles, elapsedcycles;
+	double start, elapsed;
+	char name[24];
+
+	dm2_internal_init(&dm2, &dm2_params[0]);
+	while (dm2.initialize) dm2_report(&dm2, idle, 0);
+
+	ledwrites = hostcmds = 0;
+	start = now_ns();
+	startcycles = cycles();
+	for (l = 0; l < loops; l++) {
+		for (i = 0; i < len; i += chunk) {
+			dm2_midi_parse(&dm2, &parser, buf + i, (len - i < chunk) ? len - i : chunk);
+			dm2_leds_frame(&dm2, 0);
+		}
+	}
+	elapsedcycles = cycles() - startcycles;
+	elapsed = now_ns() - start;
+
+	snprintf(name, sizeof(name), "%d byte pieces", chunk);
+	printf("%-20s %10lu %10.1f %10.2f %10.1f %10.3f\n", name, total,
+	       (double)elapsedcycles / total, elapsed / total, total / elapsed * 1e3,
+	       (double)ledwrites / total);
+}
+
+static void usage(const char *name)
+{
+	fprintf(stderr,
+		"usage: %s [-s] [-f format] [-n loops] [-p preset] [-t interval_us] [file]\n"
+		"  -s  also time the single state machines\n"
+		"  -f  auto (default), hex, raw, usbmon or pcap\n"
+		"  -n  replay the stream this often (default 100)\n"
+		"  -p  only run this preset (default: all)\n"
+		"  -t  time between reports for the LED clock (default 10000)\n",
+		name);
+	exit(1);
+}
+
+int main(int argc, char **argv)
+{
+	int opt, format = DM2_CAP_AUTO, loops = 100, preset = -1, interval = 10000;
+	int scen = 0;
+	struct dm2capture cap;
+	char name[16];
+	int i, ret;
+
+	while ((opt = getopt(argc, argv, "sf:n:p:t:")) != -1) {
+		switch (opt) {
+		case 's': scen = 1; break;
+		case 'f': format = dm2_capture_format(optarg); break;
+		case 'n': loops = atoi(optarg); break;
+		case 'p': preset = atoi(optarg); break;
+		case 't': interval = atoi(optarg); break;
+		default: usage(argv[0]);
+		}
+	}
+	if ((format < 0) || (loops < 1) || (preset >= DM2_NUMPRESETS) || (interval < 0) ||
+	    (argc - optind > 1))
+		usage(argv[0]);
+
+	memset(&cap, 0, sizeof(cap));
+	if (optind < argc) {
+		ret = dm2_capture_read(&cap, argv[optind], format, -1, -1);
+	} else {
+		ret = synth_reports(&cap);
+		scen = 1;
+	}
+	if (ret || !cap.count) {
+		fprintf(stderr, "no reports to replay\n");
+		return 1;
+	}
+	// Preprocess like dm2_update_status()
+	reports = cap.data;
+	numreports = cap.count;
+	for (i = 0; i < numreports; i++)
+		reports[i * DM2_REPORTLEN + 5] ^= 0xff;
+
+	printf("%-20s %10s %10s %10s %10s %10s %10s\n", "stream", "reports",
+	       "cycles/rep", "ns/report", "bytes/rep", "msgs/rep", "leds/rep");
+	for (opt = 0; opt < DM2_NUMPRESETS; opt++) {
+		if ((preset >= 0) && (preset != opt)) continue;
+		snprintf(name, sizeof(name), "preset %d", opt);
+		bench(name, &dm2_params[opt], reports, numreports, loops, interval, 0);
+	}
+	dm2_capture_free(&cap);
+	if (scen) {
+		bench_scenarios(loops, interval);
+		printf("\n%-20s %10s %10s %10s %10s %10s\n", "host feedback", "bytes",
+		       "cycles/b", "ns/byte", "MB/s", "leds/byte");
+		for (i = 1; i <= 1024; i *= 8) bench_feedback(loops, i);
+	}
+	return 0;
+}
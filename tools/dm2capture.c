@@ -0,0 +1,268 @@
+/*
+ * dm2capture.c  -  Read DM2 reports from captures and report files
+ *
+ *
+ * Copyright (C) 2007-2008 Jan Jockusch (jan@jockusch.de)
+ *
+ *	This program is free software; you can redistribute it and/or
+ *	modify it under the terms of the GNU General Public License as
+ *	published by the Free Software Foundation, version 2.
+ *
+ */
+
+/* A usbmon text line of a DM2 report looks like
+ *
+ *   ffff88003d1b4e40 3575914555 C Ii:2:003:1 0:8 10 = 00000000 00800000 0000
+ *
+ * (tag, time in us, event, type:bus:device:endpoint, status:interval,
+ * length, data). Captures from "cat /sys/kernel/debug/usb/usbmon/2u"
+ * and from the older 0u format (no bus number) are understood.
+ *
+ * pcap files are what tcpdump, dumpcap or Wireshark write from a
+ * usbmonN interface. pcapng has to be converted with
+ * "editcap -F pcap" first.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include <errno.h>
+
+#include "dm2capture.h"
+
+
+static int add_report(struct dm2capture *cap, const u8 *data, long long time)
+{
+	if (!(cap->count & 1023)) {
+		u8 *data = realloc(cap->data, (cap->count + 1024) * DM2_REPORTLEN);
+		long long *times;
+
+		if (!data) return -ENOMEM;
+		cap->data = data;
+		times = realloc(cap->time, (cap->count + 1024) * sizeof(*times));
+		if (!times) return -ENOMEM;
+		cap->time = times;
+	}
+	memcpy(cap->data + cap->count * DM2_REPORTLEN, data, DM2_REPORTLEN);
+	cap->time[cap->count++] = time;
+	return 0;
+}
+
+static int read_raw(struct dm2capture *cap, FILE *f)
+{
+	u8 data[DM2_REPORTLEN];
+
+	while (fread(data, DM2_REPORTLEN, 1, f) == 1)
+		if (add_report(cap, data, -1)) return -ENOMEM;
+	return 0;
+}
+
+static int read_hex(struct dm2capture *cap, FILE *f)
+{
+	char line[512], *p, *end;
+	u8 data[DM2_REPORTLEN];
+	int n, lineno = 0;
+
+	while (fgets(line, sizeof(line), f)) {
+		lineno++;
+		if ((p = strchr(line, '#'))) *p = 0;
+		for (n = 0, p = line; ; p = end) {
+			unsigned long v = strtoul(p, &end, 16);
+			if (end == p) break;
+			if ((n == DM2_REPORTLEN) || (v > 0xff)) { n = -1; break; }
+			data[n++] = v;
+		}
+		while (isspace((unsigned char)*p)) p++;
+		if (!n && !*p) continue;
+		if ((n != DM2_REPORTLEN) || *p) {
+			fprintf(stderr, "line %d: expected %d hex bytes\n", lineno, DM2_REPORTLEN);
+			return -EINVAL;
+		}
+		if (add_report(cap, data, -1)) return -ENOMEM;
+	}
+	return 0;
+}
+
+#define DM2_USBMON_WRAP	4096000000LL	/* us */
+
+static int read_usbmon(struct dm2capture *cap, FILE *f, int dev, int ep)
+{
+	char line[1024], *tok[32], *p, *save;
+	u8 data[DM2_REPORTLEN];
+	long long time, first = -1, wrap = 0;
+	unsigned long last = 0, raw;
+	int i, t, n, len;
+
+	while (fgets(line, sizeof(line), f)) {
+		for (n = 0, p = strtok_r(line, " \t\n", &save); p && (n < 32);
+		     p = strtok_r(NULL, " \t\n", &save))
+			tok[n++] = p;
+		// Successful completions of interrupt-in URBs with data only
+		if ((n < 7) || strcmp(tok[2], "C") || strncmp(tok[3], "Ii:", 3))
+			continue;
+		if (strtol(tok[4], NULL, 10) || strcmp(tok[6], "="))
+			continue;
+		p = strrchr(tok[3], ':');
+		if ((ep >= 0) && (atoi(p + 1) != ep)) continue;
+		*p = 0;
+		p = strrchr(tok[3], ':');
+		if ((dev >= 0) && (atoi(p + 1) != dev)) continue;
+
+		// Data words follow the '=', two hex digits per byte
+		len = atoi(tok[5]);
+		for (i = 0, t = 7; (len == DM2_REPORTLEN) && (t < n); t++)
+			for (p = tok[t]; isxdigit((unsigned char)p[0]) && isxdigit((unsigned char)p[1]) &&
+				     (i < DM2_REPORTLEN); p += 2) {
+				char byte[3] = { p[0], p[1], 0 };
+				data[i++] = strtoul(byte, NULL, 16);
+			}
+		if (i < DM2_REPORTLEN) {
+			cap->skipped++;
+			continue;
+		}
+
+		// usbmon prints (tv_sec & 0xfff) * 1000000 + tv_usec, so its
+		// clock wraps every 4096 seconds
+		raw = strtoul(tok[1], NULL, 10);
+		if (raw < last) wrap += DM2_USBMON_WRAP;
+		last = raw;
+		time = wrap + raw;
+		if (first < 0) first = time;
+		if (add_report(cap, data, time - first)) return -ENOMEM;
+	}
+	return 0;
+}
+
+
+/* pcap with the Linux usbmon packet header in front of the data */
+
+#define PCAP_MAGIC	0xa1b2c3d4
+#define PCAP_MAGIC_NS	0xa1b23c4d
+#define LINKTYPE_USB_LINUX		189	/* 48 byte header */
+#define LINKTYPE_USB_LINUX_MMAPPED	220	/* 64 byte header */
+
+static unsigned int get32(const u8 *p, int swap)
+{
+	if (swap) return p[3] | (p[2] << 8) | (p[1] << 16) | ((unsigned int)p[0] << 24);
+	return p[0] | (p[1] << 8) | (p[2] << 16) | ((unsigned int)p[3] << 24);
+}
+
+static int read_pcap(struct dm2capture *cap, FILE *f, int dev, int ep)
+{
+	u8 hdr[24], rec[16], *pkt = NULL;
+	unsigned int magic, caplen, linktype, hdrlen, len;
+	long long time, first = -1;
+	int swap, nano, ret = 0;
+
+	if (fread(hdr, sizeof(hdr), 1, f) != 1) return -EINVAL;
+	magic = get32(hdr, 0);
+	swap = (magic != PCAP_MAGIC) && (magic != PCAP_MAGIC_NS);
+	magic = get32(hdr, swap);
+	if ((magic != PCAP_MAGIC) && (magic != PCAP_MAGIC_NS)) {
+		fprintf(stderr, "not a pcap file\n");
+		return -EINVAL;
+	}
+	nano = (magic == PCAP_MAGIC_NS);
+	linktype = get32(hdr + 20, swap);
+	if (linktype == LINKTYPE_USB_LINUX) hdrlen = 48;
+	else if (linktype == LINKTYPE_USB_LINUX_MMAPPED) hdrlen = 64;
+	else {
+		fprintf(stderr, "pcap link type %u is not Linux USB\n", linktype);
+		return -EINVAL;
+	}
+
+	while (fread(rec, sizeof(rec), 1, f) == 1) {
+		caplen = get32(rec + 8, swap);
+		if (caplen > 0x40000) { ret = -EINVAL; break; }
+		// fread() of nothing returns 0 and would end the file here
+		if (!caplen) continue;
+		free(pkt);
+		if (!(pkt = malloc(caplen))) { ret = -ENOMEM; break; }
+		if (fread(pkt, caplen, 1, f) != 1) break;
+		if (caplen < hdrlen) continue;
+
+		// struct usbmon_packet: type, xfer_type, epnum, devnum at 8..11,
+		// status at 28, captured data length at 36
+		if ((pkt[8] != 'C') || (pkt[9] != 1) || !(pkt[10] & 0x80)) continue;
+		if ((ep >= 0) && ((pkt[10] & 0x7f) != ep)) continue;
+		if ((dev >= 0) && (pkt[11] != dev)) continue;
+		if (get32(pkt + 28, swap)) continue;
+		len = get32(pkt + 36, swap);
+		if ((len != DM2_REPORTLEN) || (caplen < hdrlen + len)) {
+			cap->skipped++;
+			continue;
+		}
+
+		time = get32(rec, swap) * 1000000LL + get32(rec + 4, swap) / (nano ? 1000 : 1);
+		if (first < 0) first = time;
+		if ((ret = add_report(cap, pkt + hdrlen, time - first))) break;
+	}
+	free(pkt);
+	return ret;
+}
+
+
+int dm2_capture_format(const char *name)
+{
+	static const char *names[] = { "auto", "hex", "raw", "usbmon", "pcap" };
+	int i;
+
+	for (i = 0; i < (int)(sizeof(names)/sizeof(names[0])); i++)
+		if (!strcmp(name, names[i])) return i;
+	return -1;
+}
+
+static int detect_format(FILE *f)
+{
+	char line[1024];
+	u8 magic[4];
+	int format = DM2_CAP_HEX, n;
+
+	n = fread(magic, 1, 4, f);
+	rewind(f);
+	if (n == 4) {
+		unsigned int m = get32(magic, 0);
+		if ((m == PCAP_MAGIC) || (m == PCAP_MAGIC_NS) ||
+		    (get32(magic, 1) == PCAP_MAGIC) || (get32(magic, 1) == PCAP_MAGIC_NS))
+			return DM2_CAP_PCAP;
+	}
+	for (n = 0; (n < 20) && fgets(line, sizeof(line), f); n++) {
+		if (strstr(line, " Ii:") || strstr(line, " Io:") ||
+		    strstr(line, " Ci:") || strstr(line, " Co:")) {
+			format = DM2_CAP_USBMON;
+			break;
+		}
+	}
+	rewind(f);
+	return format;
+}
+
+int dm2_capture_read(struct dm2capture *cap, const char *path, int format,
+		     int dev, int ep)
+{
+	FILE *f;
+	int ret;
+
+	memset(cap, 0, sizeof(*cap));
+	f = fopen(path, "rb");
+	if (!f) return -errno;
+	if (format == DM2_CAP_AUTO) format = detect_format(f);
+
+	switch (format) {
+	case DM2_CAP_RAW:	ret = read_raw(cap, f); break;
+	case DM2_CAP_USBMON:	ret = read_usbmon(cap, f, dev, ep); break;
+	case DM2_CAP_PCAP:	ret = read_pcap(cap, f, dev, ep); break;
+	default:		ret = read_hex(cap, f);
+	}
+	fclose(f);
+	if (ret) dm2_capture_free(cap);
+	return ret;
+}
+
+void dm2_capture_free(struct dm2capture *cap)
+{
+	free(cap->data);
+	free(cap->time);
+	memset(cap, 0, sizeof(*cap));
+}
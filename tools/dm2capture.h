@@ -0,0 +1,39 @@
+/*
+ * dm2capture.h  -  Read DM2 reports from captures and report files
+ *
+ *
+ * Copyright (C) 2007-2008 Jan Jockusch (jan@jockusch.de)
+ *
+ *	This program is free software; you can redistribute it and/or
+ *	modify it under the terms of the GNU General Public License as
+ *	published by the Free Software Foundation, version 2.
+ *
+ */
+
+#ifndef _DM2CAPTURE_H
+#define _DM2CAPTURE_H
+
+#include "dm2core.h"
+
+#define DM2_CAP_AUTO	0	/* pcap by magic, usbmon or hex text by content */
+#define DM2_CAP_HEX	1	/* ten hex bytes per line, '#' comments */
+#define DM2_CAP_RAW	2	/* raw 10 byte records */
+#define DM2_CAP_USBMON	3	/* usbmon text (0u or 1u) */
+#define DM2_CAP_PCAP	4	/* pcap with Linux USB headers (linktype 189/220) */
+
+/* Reports exactly as the device sent them, i.e. byte 5 not inverted */
+struct dm2capture {
+	int		count;
+	u8		*data;		/* count * DM2_REPORTLEN bytes */
+	long long	*time;		/* us since the first report, -1 if unknown */
+	int		skipped;	/* matching completions that were not 10 bytes */
+};
+
+/* Only completions of device dev, endpoint ep are taken from usbmon */
+/* and pcap captures; -1 takes any interrupt-in endpoint. */
+int dm2_capture_read(struct dm2capture *cap, const char *path, int format,
+		     int dev, int ep);
+void dm2_capture_free(struct dm2capture *cap);
+int dm2_capture_format(const char *name);
+
+#endif /* _DM2CAPTURE_H */
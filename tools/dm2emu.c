@@ -0,0 +1,632 @@
+/*
+ * dm2emu.c  -  Emulate a Mixman DM2 with raw-gadget for end-to-end tests
+ *
+ *
+ * Copyright (C) 2007-2008 Jan Jockusch (jan@jockusch.de)
+ *
+ *	This program is free software; you can redistribute it and/or
+ *	modify it under the terms of the GNU General Public License as
+ *	published by the Free Software Foundation, version 2.
+ *
+ */
+
+/* Presents a DM2 (0665:0301, one int-in and one int-out endpoint) on a
+ * USB device controller through raw-gadget, usually the dummy_hcd one
+ * looped back to the same machine:
+ *
+ *   modprobe dummy_hcd; modprobe raw_gadget; modprobe dm2
+ *   tools/dm2emu [options] [script]
+ *
+ * Once dm2 has probed, the emulator opens the rawmidi device of the
+ * card, calibrates the driver with the first report, then plays the
+ * script (any file dm2capture.c reads, at its own pace) or, without
+ * one, a button toggling on every report. LED bytes written to the
+ * int-out endpoint are logged with -l.
+ *
+ * Every report is also run through the local copy of the core, which
+ * tells which MIDI messages the driver has to send for it. Messages
+ * read from the rawmidi device are matched against that list, so the
+ * time from the int-in transfer to the MIDI byte in userspace can be
+ * measured per message and content errors are counted.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <pthread.h>
+#include <sched.h>
+#include <stdatomic.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
+
+#include <linux/usb/ch9.h>
+#include <linux/usb/raw_gadget.h>
+
+#include "dm2core.h"
+#include "dm2capture.h"
+
+#define DM2_VENDOR	0x0665
+#define DM2_PRODUCT	0x0301
+#define DM2_OUTPACKET	8		/* int-out wMaxPacketSize */
+#define CALIBRATION	60		/* Reports sent before the script */
+#define TOGGLES		2000		/* Reports of the default script */
+
+static int fd;				/* /dev/raw-gadget */
+static int speed = USB_SPEED_FULL;
+static int interval = 10;		/* bInterval in ms */
+static int inpacket = 16;		/* int-in wMaxPacketSize */
+static int ep_in = -1, ep_out = -1;	/* raw-gadget handles */
+static u8 addr_in = 0x81, addr_out = 0x02;
+static FILE *ledlog;
+static unsigned long ledwrites;
+
+static u8 *script;			/* reports as sent, calibration first */
+static long long *when;			/* us after start to send each report */
+static int numreports;
+
+/* MIDI the driver must send, computed with the local core */
+struct expect {
+	u8	status, param, value;
+	int	report;
+};
+static struct expect *expected;
+static int numexpected, predicting;
+
+static atomic_llong *sent;		/* ns, int-in transfer completed */
+static long long *waits;		/* ns between queueing and completion */
+static long long *latencies;		/* ns, per matched message */
+static int received, mismatches;
+static atomic_int played;		/* the whole script went out */
+
+static long long t_configured, t_midi;
+
+
+static long long now_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+static void die(const char *what)
+{
+	perror(what);
+	exit(1);
+}
+
+
+/* Output hooks of the local core */
+
+void dm2_midi_send(struct dm2 *dm2, u8 cmd, u8 param, u8 value)
+{
+	if (!(numexpected & 1023)) {
+		expected = realloc(expected, (numexpected + 1024) * sizeof(*expected));
+		if (!expected) die("realloc");
+	}
+	expected[numexpected].status = cmd;
+	expected[numexpected].param = param;
+	expected[numexpected].value = value;
+	expected[numexpected].report = predicting;
+	numexpected++;
+}
+
+void dm2_ump_send(struct dm2 *dm2, u8 cmd, u8 index, u32 value)
+{
+}
+
+void dm2_set_leds(struct dm2 *dm2, u8 left, u8 right)
+{
+}
+
+void dm2_midi_command(struct dm2 *dm2, u8 status, const u8 *data, int len)
+{
+}
+
+
+/* Descriptors */
+
+static struct usb_device_descriptor dev_desc = {
+	.bLength =		USB_DT_DEVICE_SIZE,
+	.bDescriptorType =	USB_DT_DEVICE,
+	.bcdUSB =		0x0110,
+	.bDeviceClass =		0,
+	.bMaxPacketSize0 =	64,
+	.idVendor =		DM2_VENDOR,
+	.idProduct =		DM2_PRODUCT,
+	.bcdDevice =		0x0100,
+	.iManufacturer =	1,
+	.iProduct =		2,
+	.bNumConfigurations =	1,
+};
+
+static int config_desc(u8 *buf)
+{
+	struct usb_config_descriptor config = {
+		.bLength =		USB_DT_CONFIG_SIZE,
+		.bDescriptorType =	USB_DT_CONFIG,
+		.bNumInterfaces =	1,
+		.bConfigurationValue =	1,
+		.bmAttributes =		USB_CONFIG_ATT_ONE,
+		.bMaxPower =		50,
+	};
+	struct usb_interface_descriptor iface = {
+		.bLength =		USB_DT_INTERFACE_SIZE,
+		.bDescriptorType =	USB_DT_INTERFACE,
+		.bNumEndpoints =	2,
+		.bInterfaceClass =	USB_CLASS_VENDOR_SPEC,
+	};
+	struct usb_endpoint_descriptor in = {
+		.bLength =		USB_DT_ENDPOINT_SIZE,
+		.bDescriptorType =	USB_DT_ENDPOINT,
+		.bEndpointAddress =	addr_in,
+		.bmAttributes =		USB_ENDPOINT_XFER_INT,
+		.bInterval =		interval,
+	};
+	struct usb_endpoint_descriptor out = in;
+	int len = 0;
+
+	in.wMaxPacketSize = inpacket;
+	out.bEndpointAddress = addr_out;
+	out.wMaxPacketSize = DM2_OUTPACKET;
+	config.wTotalLength = USB_DT_CONFIG_SIZE + USB_DT_INTERFACE_SIZE +
+		2*USB_DT_ENDPOINT_SIZE;
+	memcpy(buf + len, &config, USB_DT_CONFIG_SIZE); len += USB_DT_CONFIG_SIZE;
+	memcpy(buf + len, &iface, USB_DT_INTERFACE_SIZE); len += USB_DT_INTERFACE_SIZE;
+	memcpy(buf + len, &in, USB_DT_ENDPOINT_SIZE); len += USB_DT_ENDPOINT_SIZE;
+	memcpy(buf + len, &out, USB_DT_ENDPOINT_SIZE); len += USB_DT_ENDPOINT_SIZE;
+	return len;
+}
+
+static int string_desc(u8 *buf, int index)
+{
+	static const char *strings[] = { NULL, "Mixman", "DM2" };
+	const char *s;
+	int i;
+
+	buf[1] = USB_DT_STRING;
+	if (!index) {
+		buf[0] = 4; buf[2] = 0x09; buf[3] = 0x04;	/* en-US */
+		return 4;
+	}
+	if (index > 2) return -1;
+	for (s = strings[index], i = 0; s[i]; i++) {
+		buf[2 + 2*i] = s[i];
+		buf[3 + 2*i] = 0;
+	}
+	buf[0] = 2 + 2*i;
+	return buf[0];
+}
+
+
+/* raw-gadget plumbing */
+
+struct ep_io {
+	struct usb_raw_ep_io	io;
+	u8			data[256];
+};
+
+static void ep0_reply(const u8 *data, int len)
+{
+	struct ep_io io;
+
+	io.io.ep = 0;
+	io.io.flags = 0;
+	io.io.length = len;
+	if (len) memcpy(io.data, data, len);
+	if (ioctl(fd, USB_RAW_IOCTL_EP0_WRITE, &io) < 0) perror("ep0 write");
+}
+
+static void ep0_ack(void)
+{
+	struct ep_io io;
+
+	io.io.ep = 0;
+	io.io.flags = 0;
+	io.io.length = 0;
+	if (ioctl(fd, USB_RAW_IOCTL_EP0_READ, &io) < 0) perror("ep0 ack");
+}
+
+/* Pick interrupt capable endpoints of the UDC */
+static void find_endpoints(void)
+{
+	struct usb_raw_eps_info info;
+	int i, n, found_in = 0, found_out = 0;
+
+	memset(&info, 0, sizeof(info));
+	n = ioctl(fd, USB_RAW_IOCTL_EPS_INFO, &info);
+	if (n < 0) die("eps info");
+	for (i = 0; i < n; i++) {
+		struct usb_raw_ep_info *ep = &info.eps[i];
+		u8 num = (ep->addr == USB_RAW_EP_ADDR_ANY) ? 0 : ep->addr;
+
+		if (!ep->caps.type_int) continue;
+		if (!found_in && ep->caps.dir_in) {
+			addr_in = USB_DIR_IN | (num ? num : 1);
+			found_in = 1;
+		} else if (!found_out && ep->caps.dir_out &&
+			   (!num || (num != (addr_in & 0x0f)))) {
+			addr_out = USB_DIR_OUT | (num ? num : 2);
+			found_out = 1;
+		}
+	}
+	if (!found_in || !found_out) {
+		fprintf(stderr, "UDC has no interrupt in/out endpoints\n");
+		exit(1);
+	}
+}
+
+static void *play_thread(void *arg);
+static void *led_thread(void *arg);
+
+static void set_configuration(void)
+{
+	u8 buf[64];
+	struct usb_endpoint_descriptor *in, *out;
+	pthread_t thread;
+
+	config_desc(buf);
+	in = (void *)(buf + USB_DT_CONFIG_SIZE + USB_DT_INTERFACE_SIZE);
+	out = (void *)(buf + USB_DT_CONFIG_SIZE + USB_DT_INTERFACE_SIZE + USB_DT_ENDPOINT_SIZE);
+	if ((ep_in = ioctl(fd, USB_RAW_IOCTL_EP_ENABLE, in)) < 0) die("enable int-in");
+	if ((ep_out = ioctl(fd, USB_RAW_IOCTL_EP_ENABLE, out)) < 0) die("enable int-out");
+	ioctl(fd, USB_RAW_IOCTL_VBUS_DRAW, 50);
+	if (ioctl(fd, USB_RAW_IOCTL_CONFIGURE, 0) < 0) die("configure");
+	ep0_ack();
+	t_configured = now_ns();
+
+	if (pthread_create(&thread, NULL, led_thread, NULL) ||
+	    pthread_create(&thread, NULL, play_thread, NULL)) {
+		fprintf(stderr, "cannot start threads\n");
+		exit(1);
+	}
+}
+
+static void *ep0_thread(void *arg)
+{
+	struct {
+		struct usb_raw_event	event;
+		struct usb_ctrlrequest	ctrl;
+	} ev;
+	u8 buf[256];
+	int len;
+
+	for (;;) {
+		ev.event.type = 0;
+		ev.event.length = sizeof(ev.ctrl);
+		if (ioctl(fd, USB_RAW_IOCTL_EVENT_FETCH, &ev) < 0) die("event fetch");
+		if (ev.event.type == USB_RAW_EVENT_CONNECT) {
+			find_endpoints();
+			continue;
+		}
+		if (ev.event.type != USB_RAW_EVENT_CONTROL) continue;
+
+		len = -1;
+		if ((ev.ctrl.bRequestType & USB_TYPE_MASK) == USB_TYPE_STANDARD) {
+			switch (ev.ctrl.bRequest) {
+			case USB_REQ_GET_DESCRIPTOR:
+				switch (ev.ctrl.wValue >> 8) {
+				case USB_DT_DEVICE:
+					memcpy(buf, &dev_desc, USB_DT_DEVICE_SIZE);
+					len = USB_DT_DEVICE_SIZE;
+					break;
+				case USB_DT_CONFIG:
+					len = config_desc(buf);
+					break;
+				case USB_DT_STRING:
+					len = string_desc(buf, ev.ctrl.wValue & 0xff);
+					break;
+				}
+				break;
+			case USB_REQ_SET_CONFIGURATION:
+				if (ep_in < 0) set_configuration();
+				else ep0_ack();
+				continue;
+			case USB_REQ_SET_INTERFACE:
+				ep0_ack();
+				continue;
+			case USB_REQ_GET_STATUS:
+				buf[0] = buf[1] = 0;
+				len = 2;
+				break;
+			}
+		}
+		if (len < 0) {
+			ioctl(fd, USB_RAW_IOCTL_EP0_STALL, 0);
+			continue;
+		}
+		if (len > ev.ctrl.wLength) len = ev.ctrl.wLength;
+		ep0_reply(buf, len);
+	}
+	return NULL;
+}
+
+
+/* Data endpoints */
+
+static void *led_thread(void *arg)
+{
+	struct ep_io io;
+	long long t;
+	int n;
+
+	for (;;) {
+		io.io.ep = ep_out;
+		io.io.flags = 0;
+		io.io.length = DM2_OUTPACKET;
+		n = ioctl(fd, USB_RAW_IOCTL_EP_READ, &io);
+		if (n < 0) break;
+		t = now_ns() - t_configured;
+		ledwrites++;
+		if (!ledlog || (n < 2)) continue;
+		fprintf(ledlog, "%lld.%06lld leds %02x %02x\n", t / 1000000000,
+			(t % 1000000000) / 1000, 0xff ^ io.data[1], 0xff ^ io.data[0]);
+	}
+	return NULL;
+}
+
+/* Open the rawmidi device of the dm2 card, once it has probed */
+static int open_midi(void)
+{
+	char path[64], name[128];
+	FILE *f;
+	int card, midi;
+
+	for (;;) {
+		for (card = 0; card < 32; card++) {
+			snprintf(path, sizeof(path), "/proc/asound/card%d/midi0", card);
+			if (!(f = fopen(path, "r"))) continue;
+			name[0] = 0;
+			if (!fgets(name, sizeof(name), f)) name[0] = 0;
+			fclose(f);
+			if (!strstr(name, "Mixman DM2")) continue;
+			snprintf(path, sizeof(path), "/dev/snd/midiC%dD0", card);
+			if ((midi = open(path, O_RDONLY | O_NONBLOCK)) < 0) continue;
+			t_midi = now_ns();
+			fprintf(stderr, "dm2emu: MIDI on %s\n", path);
+			return midi;
+		}
+		usleep(1000);
+	}
+}
+
+static void *play_thread(void *arg)
+{
+	struct timespec ts;
+	struct ep_io io;
+	long long start, t;
+	int i;
+
+	start = now_ns();
+	for (i = 0; i < numreports; i++) {
+		t = start + when[i] * 1000;
+		ts.tv_sec = t / 1000000000;
+		ts.tv_nsec = t % 1000000000;
+		clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL);
+
+		io.io.ep = ep_in;
+		io.io.flags = 0;
+		io.io.length = DM2_REPORTLEN;
+		memcpy(io.data, script + i * DM2_REPORTLEN, DM2_REPORTLEN);
+		t = now_ns();
+		// Returns when the host has read the report
+		if (ioctl(fd, USB_RAW_IOCTL_EP_WRITE, &io) < 0) die("int-in write");
+		atomic_store(&sent[i], now_ns());
+		waits[i] = atomic_load(&sent[i]) - t;
+	}
+	atomic_store(&played, 1);
+	return NULL;
+}
+
+
+/* MIDI side: match what the driver sends against the prediction */
+
+static void midi_message(u8 status, u8 param, u8 value, long long t)
+{
+	struct expect *e;
+	long long s;
+
+	if (received >= numexpected) {
+		mismatches++;
+		return;
+	}
+	e = &expected[received];
+	if ((e->status != (status & 0xf0)) || (e->param != param) || (e->value != value))
+		mismatches++;
+	// The message may overtake the return of our write() call
+	while (!(s = atomic_load(&sent[e->report]))) sched_yield();
+	latencies[received++] = (t > s) ? t - s : 0;
+}
+
+/* Until everything is matched, or one second after the script ended */
+static void read_midi(int midi)
+{
+	struct pollfd pfd = { .fd = midi, .events = POLLIN };
+	u8 buf[256], status = 0, args[2];
+	long long t;
+	int i, n, nargs = 0, idle = 0;
+
+	for (;;) {
+		if (atomic_load(&played) && ((received >= numexpected) || (idle >= 10)))
+			break;
+		if (poll(&pfd, 1, 100) <= 0) {
+			if (atomic_load(&played)) idle++;
+			continue;
+		}
+		n = read(midi, buf, sizeof(buf));
+		t = now_ns();
+		if (n <= 0) continue;
+		for (i = 0; i < n; i++) {
+			if (buf[i] >= 0xf8) continue;		// real time
+			if (buf[i] & 0x80) {
+				status = buf[i];
+				nargs = 0;
+				continue;
+			}
+			if (!status) continue;
+			args[nargs++] = buf[i];
+			if (((status & 0xf0) == 0xc0) || ((status & 0xf0) == 0xd0)) {
+				midi_message(status, args[0], 0, t);
+				nargs = 0;
+			} else if (nargs == 2) {
+				midi_message(status, args[0], args[1], t);
+				nargs = 0;
+			}
+		}
+	}
+}
+
+static int cmp_ll(const void *a, const void *b)
+{
+	long long x = *(const long long *)a, y = *(const long long *)b;
+	return (x > y) - (x < y);
+}
+
+static void percentiles(const char *what, long long *v, int n)
+{
+	qsort(v, n, sizeof(*v), cmp_ll);
+	printf("%-18s p50 %8.1f  p90 %8.1f  p99 %8.1f  p99.9 %8.1f  max %8.1f us\n", what,
+	       v[n/2] / 1e3, v[n*9/10] / 1e3, v[n*99/100] / 1e3, v[n*999/1000] / 1e3,
+	       v[n-1] / 1e3);
+}
+
+
+/* Script */
+
+static void build_script(const char *path, int format, int preset, int step)
+{
+	static struct dm2 dm2;
+	struct dm2capture cap;
+	u8 report[DM2_REPORTLEN];
+	int i, ret, total;
+
+	memset(&cap, 0, sizeof(cap));
+	if (path) {
+		if ((ret = dm2_capture_read(&cap, path, format, -1, -1))) {
+			fprintf(stderr, "%s: %s\n", path, strerror(-ret));
+			exit(1);
+		}
+		if (!cap.count) {
+			fprintf(stderr, "%s: no DM2 reports found\n", path);
+			exit(1);
+		}
+	}
+	total = CALIBRATION + (path ? cap.count : TOGGLES);
+	script = calloc(total, DM2_REPORTLEN);
+	when = calloc(total, sizeof(*when));
+	sent = calloc(total, sizeof(*sent));
+	waits = calloc(total, sizeof(*waits));
+	if (!script || !when || !sent || !waits) die("calloc");
+
+	// Centered sliders for calibration, X axis is inverted
+	memset(report, 0, sizeof(report));
+	report[5] = 0x7f; report[6] = report[7] = 0x80;
+	if (path) memcpy(report, cap.data, DM2_REPORTLEN);
+	for (i = 0; i < total; i++) {
+		if (i >= CALIBRATION) {
+			if (path) {
+				memcpy(report, cap.data + (i - CALIBRATION) * DM2_REPORTLEN,
+				       DM2_REPORTLEN);
+			} else {
+				report[2] ^= 0x01;	// Stop button: one note per report
+			}
+		}
+		memcpy(script + i * DM2_REPORTLEN, report, DM2_REPORTLEN);
+		if (path && (i >= CALIBRATION) && (cap.time[i - CALIBRATION] >= 0))
+			when[i] = (CALIBRATION - 1) * step + cap.time[i - CALIBRATION];
+		else if (i)
+			when[i] = when[i - 1] + step;
+	}
+	numreports = total;
+	dm2_capture_free(&cap);
+
+	// What the driver will make of it
+	dm2_internal_init(&dm2, &dm2_params[preset]);
+	for (predicting = 0; predicting < numreports; predicting++) {
+		memcpy(report, script + predicting * DM2_REPORTLEN, DM2_REPORTLEN);
+		report[5] = ~report[5];
+		dm2_report(&dm2, report, (u32)when[predicting]);
+		dm2_tick(&dm2, (u32)when[predicting]);
+	}
+	latencies = calloc(numexpected + 1, sizeof(*latencies));
+	if (!latencies) die("calloc");
+}
+
+static void usage(const char *name)
+{
+	fprintf(stderr,
+		"usage: %s [-D driver] [-d device] [-s low|full] [-i interval_ms]\n"
+		"          [-f format] [-p preset] [-t step_us] [-l ledlog] [script]\n"
+		"  -D, -d  UDC driver and instance (default dummy_udc, dummy_udc.0)\n"
+		"  -s      device speed (default full)\n"
+		"  -i      bInterval of both endpoints (default 10)\n"
+		"  -f      script format: auto (default), hex, raw, usbmon or pcap\n"
+		"  -p      preset the driver is in (default 0)\n"
+		"  -t      time between reports without time stamps (default 10000)\n"
+		"  -l      log LED bytes from the int-out endpoint to this file\n",
+		name);
+	exit(1);
+}
+
+int main(int argc, char **argv)
+{
+	const char *driver = "dummy_udc", *device = "dummy_udc.0";
+	int opt, format = DM2_CAP_AUTO, preset = 0, step = 10000, midi;
+	struct usb_raw_init init;
+	pthread_t thread;
+
+	while ((opt = getopt(argc, argv, "D:d:s:i:f:p:t:l:")) != -1) {
+		switch (opt) {
+		case 'D': driver = optarg; break;
+		case 'd': device = optarg; break;
+		case 's': speed = strcmp(optarg, "low") ? USB_SPEED_FULL : USB_SPEED_LOW; break;
+		case 'i': interval = atoi(optarg); break;
+		case 'f': format = dm2_capture_format(optarg); break;
+		case 'p': preset = atoi(optarg); break;
+		case 't': step = atoi(optarg); break;
+		case 'l':
+			if (!(ledlog = fopen(optarg, "w"))) die(optarg);
+			break;
+		default: usage(argv[0]);
+		}
+	}
+	if ((format < 0) || (preset < 0) || (preset >= DM2_NUMPRESETS) ||
+	    (interval < 1) || (interval > 255) || (step < 0) || (argc - optind > 1))
+		usage(argv[0]);
+
+	// Like the real thing, which sends its reports in two packets
+	if (speed == USB_SPEED_LOW) {
+		dev_desc.bMaxPacketSize0 = 8;
+		inpacket = 8;
+	}
+
+	build_script((optind < argc) ? argv[optind] : NULL, format, preset, step);
+
+	if ((fd = open("/dev/raw-gadget", O_RDWR)) < 0) die("/dev/raw-gadget");
+	memset(&init, 0, sizeof(init));
+	strncpy((char *)init.driver_name, driver, UDC_NAME_LENGTH_MAX - 1);
+	strncpy((char *)init.device_name, device, UDC_NAME_LENGTH_MAX - 1);
+	init.speed = speed;
+	if (ioctl(fd, USB_RAW_IOCTL_INIT, &init) < 0) die("raw-gadget init");
+	if (ioctl(fd, USB_RAW_IOCTL_RUN, 0) < 0) die("raw-gadget run");
+	if (pthread_create(&thread, NULL, ep0_thread, NULL)) die("pthread_create");
+
+	// Playing starts with SET_CONFIGURATION, but the reports are only
+	// read once dm2 has probed, by which time the MIDI port is open.
+	midi = open_midi();
+	read_midi(midi);
+
+	printf("probe              %.1f ms from SET_CONFIGURATION to the MIDI device\n",
+	       (t_midi - t_configured) / 1e6);
+	printf("reports            %d sent, %lu LED writes received\n", numreports, ledwrites);
+	printf("messages           %d of %d received, %d wrong\n",
+	       received, numexpected, mismatches);
+	percentiles("int-in queueing", waits, numreports);
+	if (received) percentiles("report to MIDI", latencies, received);
+	if (ledlog) fclose(ledlog);
+	return (received == numexpected) && !mismatches ? 0 : 1;
+}
@@ -0,0 +1,209 @@
+/*
+ * dm2presets.c  -  Write and check DM2 preset files
+ *
+ *
+ * Copyright (C) 2007-2008 Jan Jockusch (jan@jockusch.de)
+ *
+ *	This program is free software; you can redistribute it and/or
+ *	modify it under the terms of the GNU General Public License as
+ *	published by the Free Software Foundation, version 2.
+ *
+ */
+
+/* Preset files (see struct dm2_presetfile in dm2core.h) replace the
+ * built-in presets when the driver loads them from the firmware path:
+ *
+ *   dm2presets -w dm2-presets.bin       built-in presets, to start from
+ *   dm2presets dm2-presets.bin          check a file, print its presets
+ *
+ * Presets are printed one field per line, as "<preset> <field> <values>".
+ * The same lines, edited, are read back by -c, e.g.
+ *
+ *   dm2presets dm2-presets.bin > mine.txt
+ *   dm2presets -c mine.txt -w /lib/firmware/mine.bin
+ *   echo mine.bin > /sys/bus/usb/drivers/Mixman\ DM2/<interface>/presets
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stddef.h>
+#include <unistd.h>
+
+#include "dm2core.h"
+
+#define FIELD(name)	{ #name, offsetof(struct dm2_params, name), \
+			  sizeof(((struct dm2_params *)0)->name) }
+
+static const struct field {
+	const char *name;
+	size_t offset, count;
+} fields[] = {
+	FIELD(sliderparam), FIELD(sliderdeadzone), FIELD(sliderhyst),
+	FIELD(sliderfilter), FIELD(sliderinterval), FIELD(paramthresh),
+	FIELD(cursorthresh), FIELD(wheel0jogparam), FIELD(wheel1jogparam),
+	FIELD(wheel0notes), FIELD(wheel0params), FIELD(wheel1notes),
+	FIELD(wheel1params), FIELD(relparams0), FIELD(relparams1),
+	FIELD(notoggle0), FIELD(notoggle1), FIELD(buttons0), FIELD(buttons1),
+	FIELD(midup0), FIELD(middown0), FIELD(midup1), FIELD(middown1),
+	FIELD(midrel0), FIELD(midrel1), FIELD(excl0), FIELD(excl1),
+	FIELD(led0notes), FIELD(led1notes), FIELD(led0idle), FIELD(led1idle),
+	FIELD(hires), FIELD(jogcurve), FIELD(jogpos0), FIELD(jogpos1),
+};
+#define NUMFIELDS (sizeof(fields) / sizeof(fields[0]))
+
+static struct dm2_params presets[DM2_MAXPRESETS];
+
+/* Output hooks, nothing is run through the core here */
+void dm2_midi_send(struct dm2 *dm2, u8 cmd, u8 param, u8 value) { }
+void dm2_ump_send(struct dm2 *dm2, u8 cmd, u8 index, u32 value) { }
+void dm2_set_leds(struct dm2 *dm2, u8 left, u8 right) { }
+void dm2_midi_command(struct dm2 *dm2, u8 status, const u8 *data, int len) { }
+
+static void usage(const char *prog)
+{
+	fprintf(stderr,
+		"usage: %s [-c text] [-w file] [file]\n"
+		"  file     preset file to check and print\n"
+		"  -c text  read presets from the printed text form\n"
+		"  -w file  write the presets (default: built-in) as a preset file\n",
+		prog);
+	exit(2);
+}
+
+static int read_file(const char *name)
+{
+	static u8 buf[sizeof(struct dm2_presetfile) + sizeof(presets)];
+	FILE *f = fopen(name, "rb");
+	size_t len;
+	int n;
+
+	if (!f) {
+		perror(name);
+		exit(2);
+	}
+	len = fread(buf, 1, sizeof(buf), f);
+	fclose(f);
+	if ((n = dm2_presets_parse(buf, len, presets)) < 0) {
+		fprintf(stderr, "%s: not a valid version %d preset file, or a preset "
+			"fails the checks of -c\n", name, DM2_PRESETVERSION);
+		exit(1);
+	}
+	return n;
+}
+
+static int read_text(const char *name)
+{
+	FILE *f = fopen(name, "r");
+	char line[256], field[32], *p;
+	int n = 0, preset, len, lineno = 0, v;
+	size_t i, j;
+
+	if (!f) {
+		perror(name);
+		exit(2);
+	}
+	while (fgets(line, sizeof(line), f)) {
+		lineno++;
+		if ((line[0] == '#') || (line[0] == '\n')) continue;
+		if ((sscanf(line, "%d %31s%n", &preset, field, &len) != 2) ||
+		    (preset < 0) || (preset >= DM2_MAXPRESETS))
+			goto bad;
+		for (i = 0; (i < NUMFIELDS) && strcmp(fields[i].name, field); i++);
+		if (i == NUMFIELDS) goto bad;
+		p = line + len;
+		for (j = 0; j < fields[i].count; j++, p += len) {
+			if ((sscanf(p, "%d%n", &v, &len) != 1) || (v < 0) || (v > 127))
+				goto bad;
+			((u8 *)&presets[preset])[fields[i].offset + j] = v;
+		}
+		if (preset >= n) n = preset + 1;
+	}
+	fclose(f);
+	if (!n) {
+		fprintf(stderr, "%s: no presets\n", name);
+		exit(1);
+	}
+	return n;
+bad:
+	fprintf(stderr, "%s:%d: expected <preset> <field> <values 0-127>\n", name, lineno);
+	exit(1);
+}
+
+static void print_presets(int n)
+{
+	size_t i, j;
+	int preset;
+
+	for (preset = 0; preset < n; preset++) {
+		for (i = 0; i < NUMFIELDS; i++) {
+			printf("%d %s", preset, fields[i].name);
+			for (j = 0; j < fields[i].count; j++)
+				printf(" %u", ((u8 *)&presets[preset])[fields[i].offset + j]);
+			printf("\n");
+		}
+		if (preset < n - 1) printf("\n");
+	}
+}
+
+static void write_file(const char *name, int n)
+{
+	struct dm2_presetfile head;
+	FILE *f = fopen(name, "wb");
+
+	if (!f) {
+		perror(name);
+		exit(2);
+	}
+	memcpy(head.magic, DM2_PRESETMAGIC, 4);
+	head.version = DM2_PRESETVERSION;
+	head.count = n;
+	head.size = sizeof(struct dm2_params);
+	head.reserved = 0;
+	if ((fwrite(&head, sizeof(head), 1, f) != 1) ||
+	    (fwrite(presets, sizeof(struct dm2_params), n, f) != (size_t)n) ||
+	    fclose(f)) {
+		perror(name);
+		exit(2);
+	}
+}
+
+int main(int argc, char **argv)
+{
+	const char *textname = NULL, *outname = NULL, *problem;
+	int opt, n, i;
+
+	while ((opt = getopt(argc, argv, "c:w:")) != -1) {
+		switch (opt) {
+		case 'c': textname = optarg; break;
+		case 'w': outname = optarg; break;
+		default: usage(argv[0]);
+		}
+	}
+	if ((argc - optind > 1) || ((argc - optind == 1) && textname) ||
+	    ((argc - optind == 0) && !textname && !outname))
+		usage(argv[0]);
+
+	if (textname)
+		n = read_text(textname);
+	else if (argc - optind == 1)
+		n = read_file(argv[optind]);
+	else {
+		memcpy(presets, dm2_params, sizeof(dm2_params));
+		n = DM2_NUMPRESETS;
+	}
+
+	if (outname) {
+		for (i = 0; i < n; i++)
+			if ((problem = dm2_params_check(&presets[i]))) {
+				fprintf(stderr, "preset %d: %s\n", i, problem);
+				exit(1);
+			}
+		write_file(outname, n);
+		// Whatever -c accepted has to load in the driver, too
+		read_file(outname);
+		return 0;
+	}
+	print_presets(n);
+	return 0;
+}
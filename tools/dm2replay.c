@@ -0,0 +1,205 @@
+/*
+ * dm2replay.c  -  Turn a DM2 capture into the MIDI stream the driver sends
+ *
+ *
+ * Copyright (C) 2007-2008 Jan Jockusch (jan@jockusch.de)
+ *
+ *	This program is free software; you can redistribute it and/or
+ *	modify it under the terms of the GNU General Public License as
+ *	published by the Free Software Foundation, version 2.
+ *
+ */
+
+/* Feeds the reports of a capture (see dm2capture.c) through the core
+ * and writes one line per MIDI message or LED change:
+ *
+ *   <seconds since first report> <status> <data1> <data2>
+ *   <seconds since first report> leds <left> <right>
+ *   <seconds since first report> ump <status> <index> <value>   (-u only)
+ *
+ * With -g the output is compared against a golden file written by an
+ * earlier run instead, and the exit status tells whether it matched.
+ * Time stamps come from the capture; files without them advance by
+ * the -t interval per report. The LED clock is driven by the same
+ * time stamps, so the output does not depend on the host.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdarg.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "dm2core.h"
+#include "dm2capture.h"
+
+#define MAXDIFFS	10	/* Differences printed before giving up */
+
+static struct dm2_params presets[DM2_MAXPRESETS];
+static int numpresets = DM2_NUMPRESETS;
+
+static FILE *out, *golden;
+static long long now;		/* us, time of the report being processed */
+static unsigned long lines, diffs;
+
+static void emit(const char *fmt, ...) __attribute__((format(printf, 1, 2)));
+
+static void emit(const char *fmt, ...)
+{
+	char line[64], expect[256];
+	va_list ap;
+	int n;
+
+	n = snprintf(line, sizeof(line), "%lld.%06lld ", now / 1000000, now % 1000000);
+	va_start(ap, fmt);
+	vsnprintf(line + n, sizeof(line) - n, fmt, ap);
+	va_end(ap);
+	lines++;
+
+	if (out) fputs(line, out);
+	if (!golden) return;
+	if (!fgets(expect, sizeof(expect), golden)) strcpy(expect, "<end of file>\n");
+	if (!strcmp(line, expect)) return;
+	if (++diffs <= MAXDIFFS)
+		fprintf(stderr, "line %lu:\n  golden: %s  replay: %s", lines, expect, line);
+}
+
+
+/* Output hooks of the core */
+
+void dm2_midi_send(struct dm2 *dm2, u8 cmd, u8 param, u8 value)
+{
+	emit("%02x %02x %02x\n", cmd, param, value);
+}
+
+void dm2_ump_send(struct dm2 *dm2, u8 cmd, u8 index, u32 value)
+{
+	emit("ump %02x %02x %08x\n", cmd, index, value);
+}
+
+void dm2_set_leds(struct dm2 *dm2, u8 left, u8 right)
+{
+	emit("leds %02x %02x\n", left, right);
+}
+
+void dm2_midi_command(struct dm2 *dm2, u8 status, const u8 *data, int len)
+{
+}
+
+
+static void load_presets(const char *name)
+{
+	static u8 buf[sizeof(struct dm2_presetfile) + sizeof(presets)];
+	FILE *f = fopen(name, "rb");
+	size_t len;
+
+	if (!f) {
+		perror(name);
+		exit(2);
+	}
+	len = fread(buf, 1, sizeof(buf), f);
+	fclose(f);
+	if ((numpresets = dm2_presets_parse(buf, len, presets)) < 0) {
+		fprintf(stderr, "%s: not a valid preset file\n", name);
+		exit(2);
+	}
+}
+
+static void usage(const char *name)
+{
+	fprintf(stderr,
+		"usage: %s [-u] [-f format] [-d dev] [-e ep] [-P presetfile] [-p preset]\n"
+		"          [-t interval_us] [-o output] [-g golden] capture\n"
+		"  -u  also write the MIDI 2.0 messages of the UMP endpoint\n"
+		"  -f  auto (default), hex, raw, usbmon or pcap\n"
+		"  -d  only reports from this USB device number\n"
+		"  -e  only reports from this interrupt-in endpoint\n"
+		"  -P  take the presets from a preset file (see dm2presets)\n"
+		"  -p  preset to load (default 0)\n"
+		"  -t  time between reports of files without time stamps (default 10000)\n"
+		"  -o  write the stream here (default: stdout unless -g is given)\n"
+		"  -g  compare the stream with this golden file\n",
+		name);
+	exit(2);
+}
+
+int main(int argc, char **argv)
+{
+	int opt, format = DM2_CAP_AUTO, dev = -1, ep = -1, preset = 0, interval = 10000;
+	int ump = 0;
+	const char *outname = NULL, *goldname = NULL;
+	static struct dm2 dm2;
+	struct dm2capture cap;
+	long long last;
+	u8 report[DM2_REPORTLEN];
+	char extra[256];
+	int i, ret;
+
+	memcpy(presets, dm2_params, sizeof(dm2_params));
+	while ((opt = getopt(argc, argv, "uf:d:e:P:p:t:o:g:")) != -1) {
+		switch (opt) {
+		case 'u': ump = 1; break;
+		case 'f': format = dm2_capture_format(optarg); break;
+		case 'd': dev = atoi(optarg); break;
+		case 'e': ep = atoi(optarg); break;
+		case 'P': load_presets(optarg); break;
+		case 'p': preset = atoi(optarg); break;
+		case 't': interval = atoi(optarg); break;
+		case 'o': outname = optarg; break;
+		case 'g': goldname = optarg; break;
+		default: usage(argv[0]);
+		}
+	}
+	if ((format < 0) || (preset < 0) || (preset >= numpresets) ||
+	    (interval < 0) || (argc - optind != 1))
+		usage(argv[0]);
+
+	if ((ret = dm2_capture_read(&cap, argv[optind], format, dev, ep))) {
+		fprintf(stderr, "%s: %s\n", argv[optind], strerror(-ret));
+		return 2;
+	}
+	if (!cap.count) {
+		fprintf(stderr, "%s: no DM2 reports found\n", argv[optind]);
+		return 2;
+	}
+	if (cap.skipped)
+		fprintf(stderr, "%s: skipped %d completions of unexpected length\n",
+			argv[optind], cap.skipped);
+
+	out = goldname ? NULL : stdout;
+	if (outname && !(out = fopen(outname, "w"))) {
+		perror(outname);
+		return 2;
+	}
+	if (goldname && !(golden = fopen(goldname, "r"))) {
+		perror(goldname);
+		return 2;
+	}
+
+	// Same order as dm2_process_pass(): the report, then an LED frame.
+	dm2_internal_init(&dm2, &presets[preset]);
+	dm2.ump = ump;
+	for (i = 0, last = 0; i < cap.count; i++) {
+		now = (cap.time[i] >= 0) ? cap.time[i] : (long long)i * interval;
+		memcpy(report, cap.data + i * DM2_REPORTLEN, DM2_REPORTLEN);
+		report[5] = ~report[5];		// like dm2_update_status()
+		dm2_report(&dm2, report, (u32)now);
+		if (!dm2.initialize) dm2_leds_frame(&dm2, (int)(now - last));
+		dm2_tick(&dm2, (u32)now);
+		last = now;
+	}
+	dm2_capture_free(&cap);
+
+	if (out && (out != stdout)) fclose(out);
+	if (!golden) return 0;
+	while (fgets(extra, sizeof(extra), golden)) {
+		lines++;
+		if (++diffs <= MAXDIFFS)
+			fprintf(stderr, "line %lu:\n  golden: %s  replay: <end of stream>\n",
+				lines, extra);
+	}
+	fclose(golden);
+	if (!diffs) return 0;
+	fprintf(stderr, "%lu of %lu lines differ from %s\n", diffs, lines, goldname);
+	return 1;
+}
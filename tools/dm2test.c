@@ -0,0 +1,527 @@
+/*
+ * dm2test.c  -  Check the MIDI the driver core sends
+ *
+ *
+ * Copyright (C) 2007-2008 Jan Jockusch (jan@jockusch.de)
+ *
+ *	This program is free software; you can redistribute it and/or
+ *	modify it under the terms of the GNU General Public License as
+ *	published by the Free Software Foundation, version 2.
+ *
+ */
+
+/* Plays short sequences of reports into dm2core.c and compares the
+ * MIDI that comes out with what it has to be: every row of the wheel
+ * key table in dm2core.h, the buttons, sliders, jog wheels and mid
+ * keys of every built-in preset, a program change with keys held, the
+ * platter position, the MIDI 2.0 values next to MIDI 1.0, slider
+ * intervals, and LED feedback and host commands through the MIDI
+ * parser. Run by "make check", exits nonzero if any case does not
+ * match. With -v every case is printed.
+ */
+
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "dm2core.h"
+
+#define TICK	10000		/* us between reports */
+
+static struct dm2 dm2;
+static u8 state[DM2_REPORTLEN];
+static u32 now;
+static char out[1024];		/* MIDI sent since the last check */
+static u8 leds[2];
+static int verbose, failed, cases;
+
+
+/* Output hooks of the core: messages are logged as hex text */
+
+static void out_add(const char *msg)
+{
+	size_t len = strlen(out);
+
+	snprintf(out + len, sizeof(out) - len, "%s%s", len ? " " : "", msg);
+}
+
+void dm2_midi_send(struct dm2 *dm2, u8 cmd, u8 param, u8 value)
+{
+	char msg[16];
+
+	snprintf(msg, sizeof(msg), "%02x %02x %02x", cmd, param, value);
+	out_add(msg);
+}
+
+void dm2_ump_send(struct dm2 *dm2, u8 cmd, u8 index, u32 value)
+{
+	char msg[24];
+
+	snprintf(msg, sizeof(msg), "ump %02x %02x %08x", cmd, index, value);
+	out_add(msg);
+}
+
+void dm2_set_leds(struct dm2 *dm2, u8 left, u8 right)
+{
+	leds[0] = left;
+	leds[1] = right;
+}
+
+void dm2_midi_command(struct dm2 *dm2, u8 status, const u8 *data, int len)
+{
+	char msg[16];
+
+	snprintf(msg, sizeof(msg), "cmd %02x %d", status, len);
+	out_add(msg);
+}
+
+
+/* Driving the core */
+
+static void report(void)
+{
+	now += TICK;
+	dm2_report(&dm2, state, now);
+	dm2_leds_frame(&dm2, TICK);
+	dm2_tick(&dm2, now);
+}
+
+/* Plug in with the sliders in the middle, and forget the calibration */
+static void start(const struct dm2_params *params)
+{
+	memset(state, 0, sizeof(state));
+	state[5] = state[6] = state[7] = 0x80;
+	now = 0;
+	dm2_internal_init(&dm2, params);
+	while (dm2.initialize) report();
+	*out = 0;
+}
+
+static void press(int byte, u8 bits)
+{
+	state[byte] |= bits;
+	report();
+}
+
+static void release(int byte, u8 bits)
+{
+	state[byte] &= ~bits;
+	report();
+}
+
+/* Positive ticks are clockwise. The report after the turn has none. */
+static void turn(int wheel, int ticks)
+{
+	state[8 + wheel] = (u8)-ticks;
+	report();
+	state[8 + wheel] = 0;
+	report();
+}
+
+static void slide(int slider, u8 raw)
+{
+	state[5 + slider] = raw;
+	report();
+}
+
+static void check(const char *name, const char *expect)
+{
+	cases++;
+	if (strcmp(out, expect)) {
+		failed++;
+		printf("FAIL %s\n  expected: %s\n  got:      %s\n", name, expect, out);
+	} else if (verbose) {
+		printf("ok   %s: %s\n", name, out);
+	}
+	*out = 0;
+}
+
+
+/* Wheel keys: one row of the table in dm2core.h each, on the NW key */
+/* of the left wheel, note 0x10 and/or param 0x10. */
+
+#define NW	0x01		/* NW key in report byte 1 */
+
+static void key_params(struct dm2_params *p, int notoggle, int note, int param)
+{
+	*p = dm2_params[0];
+	p->wheel0notes[0] = note ? 0x10 : 0;
+	p->wheel0params[0] = param ? 0x10 : 0;
+	p->notoggle0 = notoggle ? 0x01 : 0;
+	p->relparams0 = 0;
+	p->excl0 = 0;
+	p->paramthresh = 4;
+}
+
+static void test_keys(void)
+{
+	struct dm2_params p;
+
+	// press: note on, lock. 2nd release: note off, unlock
+	key_params(&p, 0, 1, 0);
+	start(&p);
+	press(1, NW);
+	check("note: press", "90 10 7f");
+	release(1, NW);
+	press(1, NW);
+	check("note: locked", "");
+	release(1, NW);
+	check("note: 2nd release", "90 10 00");
+	turn(0, 4);
+	check("note: jogs after 2nd release", "b0 01 44 b0 01 40");
+
+	// press: note on; release: note off
+	key_params(&p, 1, 1, 0);
+	start(&p);
+	press(1, NW);
+	check("note notoggle: press", "90 10 7f");
+	release(1, NW);
+	check("note notoggle: release", "90 10 00");
+
+	// press: param mode, lock. 2nd release: unlock
+	key_params(&p, 0, 0, 1);
+	start(&p);
+	press(1, NW);
+	release(1, NW);
+	turn(0, 4);
+	check("param: locked after release", "b0 10 41");
+	press(1, NW);
+	release(1, NW);
+	check("param: 2nd press and release", "");
+	turn(0, 4);
+	check("param: unlocked", "b0 01 44 b0 01 40");
+	// A turn while held does not lock
+	press(1, NW);
+	turn(0, -8);
+	check("param: turn while held", "b0 10 3f");
+	release(1, NW);
+	turn(0, 4);
+	check("param: not locked after a turn", "b0 01 44 b0 01 40");
+
+	// press: param mode. release: nothing
+	key_params(&p, 1, 0, 1);
+	start(&p);
+	press(1, NW);
+	turn(0, -4);
+	check("param notoggle: turn while held", "b0 10 3f");
+	release(1, NW);
+	check("param notoggle: release", "");
+	turn(0, 4);
+	check("param notoggle: jogs after release", "b0 01 44 b0 01 40");
+
+	// press: param mode, lock. 2nd release: note on if wheel turned, unlock
+	key_params(&p, 0, 1, 1);
+	start(&p);
+	press(1, NW);
+	release(1, NW);
+	check("note+param: press and release", "");
+	turn(0, 4);
+	check("note+param: locked", "b0 10 41");
+	press(1, NW);
+	release(1, NW);
+	check("note+param: 2nd release after a turn", "90 10 7f");
+	turn(0, 4);
+	check("note+param: unlocked", "b0 01 44 b0 01 40");
+	press(1, NW);
+	release(1, NW);
+	press(1, NW);
+	release(1, NW);
+	check("note+param: 2nd release without a turn", "");
+
+	// press: param mode. release: note on if no wheel turn
+	key_params(&p, 1, 1, 1);
+	start(&p);
+	press(1, NW);
+	release(1, NW);
+	check("note+param notoggle: release without a turn", "90 10 7f");
+	press(1, NW);
+	turn(0, 4);
+	release(1, NW);
+	check("note+param notoggle: release after a turn", "b0 10 41");
+	turn(0, 4);
+	check("note+param notoggle: jogs after release", "b0 01 44 b0 01 40");
+
+	// Bottom key resets the params of the lit keys
+	key_params(&p, 0, 0, 1);
+	start(&p);
+	press(1, NW);
+	turn(0, 8);
+	press(1, 0x08);
+	release(1, 0x08);
+	check("param: reset by the bottom key", "b0 10 42 b0 10 40");
+}
+
+
+/* Built-in presets */
+
+static void test_buttons(int n, int byte, const u8 notes[8])
+{
+	char name[32], expect[16];
+	int i;
+
+	for (i = 0; i < 8; i++) {
+		// Mid is a wheel key as well, see test_mid()
+		if (!notes[i] || ((byte == 3) && ((1 << i) & 0x02))) continue;
+		snprintf(name, sizeof(name), "preset %d: byte %d bit %d", n, byte, i);
+		press(byte, 1 << i);
+		snprintf(expect, sizeof(expect), "90 %02x 7f", notes[i]);
+		check(name, expect);
+		release(byte, 1 << i);
+		snprintf(expect, sizeof(expect), "90 %02x 00", notes[i]);
+		check(name, expect);
+	}
+}
+
+/* Sliders to both ends and back to the middle */
+static void test_sliders(int n, const struct dm2_params *p)
+{
+	char name[32], expect[64];
+	int i;
+
+	for (i = 0; i < 3; i++) {
+		snprintf(name, sizeof(name), "preset %d: slider %d", n, i);
+		slide(i, 0x10);
+		slide(i, 0xf0);
+		slide(i, 0x80);
+		snprintf(expect, sizeof(expect), "b0 %02x 00 b0 %02x 7f b0 %02x 40",
+			 p->sliderparam[i], p->sliderparam[i], p->sliderparam[i]);
+		check(name, expect);
+	}
+}
+
+static void test_jog(int n, const struct dm2_params *p)
+{
+	char name[32], expect[64];
+
+	snprintf(name, sizeof(name), "preset %d: jog", n);
+	turn(0, 3);
+	turn(1, -2);
+	snprintf(expect, sizeof(expect), "b0 %02x 43 b0 %02x 40 b0 %02x 3e b0 %02x 40",
+		 p->wheel0jogparam, p->wheel0jogparam, p->wheel1jogparam, p->wheel1jogparam);
+	check(name, expect);
+}
+
+/* Mid key and a turn: cursor keys, or the mid param. On release after */
+/* the turn, the on-release note. */
+static void test_mid(int n, const struct dm2_params *p)
+{
+	char name[32], expect[64];
+	int thresh = p->cursorthresh;
+
+	snprintf(name, sizeof(name), "preset %d: mid", n);
+	press(3, 0x02);
+	turn(0, thresh);
+	turn(0, -2 * thresh);
+	release(3, 0x02);
+	snprintf(expect, sizeof(expect), "90 %02x 7f 90 %02x 7f 90 %02x 7f 90 %02x 7f",
+		 p->midup0, p->middown0, p->middown0, p->midrel0);
+	check(name, expect);
+}
+
+static void test_presets(void)
+{
+	const struct dm2_params *p;
+	struct dm2_params bad;
+	u8 file[sizeof(struct dm2_presetfile) + sizeof(struct dm2_params)];
+	struct dm2_presetfile *head = (struct dm2_presetfile *)file;
+	char name[32];
+	int n;
+
+	for (n = 0; n < DM2_NUMPRESETS; n++) {
+		p = &dm2_params[n];
+		snprintf(name, sizeof(name), "preset %d: check", n);
+		if (dm2_params_check(p)) out_add(dm2_params_check(p));
+		check(name, "");
+		// Wheel1 params 32-39 cannot be 14 bit
+		bad = *p;
+		bad.hires = 0x10;
+		snprintf(name, sizeof(name), "preset %d: 14 bit wheel1", n);
+		out_add(dm2_params_check(&bad) ? "refused" : "taken");
+		check(name, "refused");
+		// A SysEx preset from a sender that leaves the thresholds 0
+		bad = *p;
+		bad.paramthresh = 0;
+		snprintf(name, sizeof(name), "preset %d: paramthresh 0", n);
+		out_add(dm2_params_check(&bad) ? "refused" : "taken");
+		check(name, "refused");
+		bad = *p;
+		bad.cursorthresh = 0;
+		snprintf(name, sizeof(name), "preset %d: cursorthresh 0", n);
+		out_add(dm2_params_check(&bad) ? "refused" : "taken");
+		check(name, "refused");
+
+		start(p);
+		test_buttons(n, 2, p->buttons0);
+		test_buttons(n, 3, p->buttons1);
+		test_sliders(n, p);
+		test_jog(n, p);
+		test_mid(n, p);
+	}
+
+	// A file written before the thresholds existed loads them as 0
+	memset(file, 0, sizeof(file));
+	memcpy(head->magic, DM2_PRESETMAGIC, 4);
+	head->version = DM2_PRESETVERSION;
+	head->count = 1;
+	head->size = sizeof(struct dm2_params);
+	memcpy(file + sizeof(*head), &dm2_params[0], sizeof(struct dm2_params));
+	out_add((dm2_presets_parse(file, sizeof(*head) + head->size, NULL) < 0) ? "refused" : "taken");
+	check("preset file: full", "taken");
+	head->size = offsetof(struct dm2_params, paramthresh);
+	out_add((dm2_presets_parse(file, sizeof(*head) + head->size, NULL) < 0) ? "refused" : "taken");
+	check("preset file: no thresholds", "refused");
+}
+/* Program change with keys held: their notes go off with the old */
+/* mapping, as the driver does before dm2_load_preset(). */
+static void test_switch(void)
+{
+	struct dm2_params p;
+
+	key_params(&p, 0, 1, 0);
+	start(&p);
+	press(2, 0x01);
+	press(1, NW);
+	release(1, NW);
+	check("switch: button held, note latched", "90 30 7f 90 10 7f");
+	p.buttons0[0] = 0x40;
+	p.wheel0notes[0] = 0x11;
+	dm2_notes_off(&dm2);
+	dm2_load_preset(&dm2, &p);
+	check("switch: old notes off", "90 10 00 90 30 00");
+	release(2, 0x01);
+	check("switch: release after", "90 40 00");
+}
+
+
+/* The platter position follows every tick, also those turned while */
+/* a key held the wheel in param mode, but is only sent when jogging. */
+static void test_position(void)
+{
+	struct dm2_params p;
+
+	key_params(&p, 1, 0, 1);
+	p.jogpos0 = 8;
+	start(&p);
+	turn(0, 2);
+	check("position: jog", "b0 28 02 b0 01 42 b0 01 40");
+	press(1, NW);
+	turn(0, 5);
+	release(1, NW);
+	check("position: param mode", "b0 10 41");
+	turn(0, 1);
+	check("position: jog again", "b0 28 08 b0 01 41 b0 01 40");
+}
+
+
+/* MIDI 2.0 next to MIDI 1.0: 7 and 14 bit values are upscaled min- */
+/* center-max (0x40 to 0x80000000, the top to all ones), relative */
+/* controllers get the whole signed delta. */
+static void test_ump(void)
+{
+	struct dm2_params p;
+
+	key_params(&p, 1, 0, 1);
+	p.jogpos0 = 8;
+	start(&p);
+	dm2.ump = 1;
+	press(2, 0x01);
+	release(2, 0x01);
+	check("ump: 7 bit note", "90 30 7f ump 90 30 0000ffff 90 30 00 ump 80 30 00000000");
+	press(1, NW);
+	turn(0, 4);
+	release(1, NW);
+	check("ump: 7 bit param", "b0 10 41 ump b0 10 82082082");
+	// The position counts the 4 ticks in param mode
+	turn(0, 2);
+	check("ump: 14 bit position, relative jog",
+	      "b0 28 06 ump b0 08 00180000 ump 50 01 00000002 b0 01 42 b0 01 40");
+	turn(0, -7);
+	check("ump: 14 bit top, relative back",
+	      "b0 08 7f b0 28 7f ump b0 08 ffffffff ump 50 01 fffffff9 b0 01 39 b0 01 40");
+	dm2.ump = 0;
+}
+
+
+/* Moves within sliderinterval are merged, the last one is sent when */
+/* the interval ends. A slider left alone for longer than the signed */
+/* range of the us clock (35.8 minutes) must still move at once. */
+static void test_interval(void)
+{
+	struct dm2_params p = dm2_params[0];
+
+	p.sliderinterval[2] = 30;
+	start(&p);
+	slide(2, 0x10);
+	slide(2, 0x30);
+	slide(2, 0x50);
+	check("interval: moves merged", "b0 02 00");
+	report();
+	check("interval: last move when it ends", "b0 02 26");
+	now += 40 * 60 * 1000000U;
+	slide(2, 0x80);
+	check("interval: after 40 minutes", "b0 02 40");
+}
+
+
+/* MIDI from the host */
+
+static void parse(struct dm2parser *parser, const u8 *buf, int len)
+{
+	int i;
+
+	// A byte at a time, the messages must not depend on the pieces
+	for (i = 0; i < len; i++)
+		dm2_midi_parse(&dm2, parser, buf + i, 1);
+	dm2_leds_frame(&dm2, 0);
+}
+
+static void test_host(void)
+{
+	static const u8 on[] = { 0x90, 64, 0x7f, 71, 0x7f, 80, 0x7f };
+	static const u8 off[] = { 0x80, 64, 0x00, 0x90, 71, 0x00, 80, 0x00 };
+	static const u8 cmds[] = { 0xc0, 0x02, 0xf8, 0xf0, 0x7d, 0x02, 0xf7, 0xff };
+	struct dm2parser parser;
+	char expect[16];
+
+	memset(&parser, 0, sizeof(parser));
+	start(&dm2_params[0]);
+	parse(&parser, on, sizeof(on));
+	check("host: leds on", "");
+	snprintf(expect, sizeof(expect), "%02x %02x", leds[0], leds[1]);
+	out_add(expect);
+	check("host: leds on", "81 01");
+	parse(&parser, off, sizeof(off));
+	snprintf(expect, sizeof(expect), "%02x %02x", leds[0], leds[1]);
+	out_add(expect);
+	check("host: leds off", "00 00");
+	parse(&parser, cmds, sizeof(cmds));
+	check("host: commands", "cmd c0 1 cmd f0 2 cmd ff 0");
+}
+
+
+int main(int argc, char **argv)
+{
+	int opt;
+
+	while ((opt = getopt(argc, argv, "v")) != -1) {
+		switch (opt) {
+		case 'v': verbose = 1; break;
+		default:
+			fprintf(stderr, "usage: %s [-v]\n", argv[0]);
+			return 2;
+		}
+	}
+
+	test_keys();
+	test_presets();
+	test_switch();
+	test_position();
+	test_ump();
+	test_interval();
+	test_host();
+
+	printf("%d of %d cases failed\n", failed, cases);
+	return failed ? 1 : 0;
+}